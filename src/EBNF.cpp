@@ -59,6 +59,7 @@ class EBNFParser : public Parser
 	Parser* T (const string& _w){return _SQ(2, Clear(Ignore(to_ignore)), Word(_w));}
 	Parser* I (Parser* _p)		{return _SQ(2, Clear(Ignore(to_ignore)), Ignore(_p));}
 	Parser* I (const string& _w){return I(Word(_w));}
+	Parser* R (Parser* _p)		{return Recover(I(";"), _p);} //Once a rule is named, errors in its body are skipped up to its ';'
 
 public:
 	EBNFParser()
@@ -97,67 +98,62 @@ public:
 				_R(SetValue),
 				_OP(
 					_SQ(2,
-						_OR(3, T("*"), T("+"), T("-")),
+						T(Keywords(3, "*", "+", "-")),
 						_R(SetExpression)
 					)
 				)
 			)
 		));
-		SetRule         = Root(1, _SQ(4, T(_R(Identifier)), I("="), _R(SetExpression), I(";")));
+		SetRule         = Root(1, _SQ(3, T(_R(Identifier)), I("="), R(_SQ(2, _R(SetExpression), I(";")))));
 
 		//Comments, Scanner
 		LexParser     = _OR(5,
 			T(_R(CteString)),
 			T(_R(CteChar)),
 			T(_R(Identifier)),
-			Root(1, _SQ(2, _OR(2, T("^"), T("!")), _R(LexParser))),
+			Root(1, _SQ(2, T(Keywords(2, "^", "!")), _R(LexParser))),
 			_SQ(3, I("("), _R(LexProduction), I(")"))
 		);
 		LexCombinator = Root(-1, _SQ(2, _R(LexParser),
-			_OP(_OR(4, 
-				T("*"), 
-				T("+"), 
-				T("?"),
+			_OP(_OR(2, 
+				T(Keywords(3, "*", "+", "?")),
 				T(_SQ(4, T("{"), T(_R(CteNatural)), _OP(_SQ(2, T(","), _OR(2, T("N"), T(_R(CteNatural))))), T("}")))
 			)))
 		);
 		LexSequence   = Name("&", false, _PL(_R(LexCombinator)));
 		LexChoice     = Name("|", false, Flat(2, _SQ(2, _R(LexSequence), _ST(_SQ(2, I("|"), _R(LexSequence))))));
 		LexProduction = LexChoice;
-		LexRule       = Root(1, _SQ(4, T(_R(Identifier)), I("="), _R(LexProduction), I(";")));
+		LexRule       = Root(1, _SQ(3, T(_R(Identifier)), I("="), R(_SQ(2, _R(LexProduction), I(";")))));
 
 		//Parser
 		YaccParser     = _OR(7,
 			T(_R(CteString)),
 			T(_R(CteChar)),
 			T(_R(Identifier)),
-			Root(1, _SQ(2, _OR(2, T("^"), T("!")), _R(YaccParser))),
+			Root(1, _SQ(2, T(Keywords(2, "^", "!")), _R(YaccParser))),
 			Name("[]", true, _SQ(3, I("["), _R(YaccProduction), I("]"))),
 			Name("<>", true, _SQ(3, I("<"), _R(YaccProduction), I(">"))),
 			_SQ(3, I("("), _R(YaccProduction), I(")"))
 		);
 		YaccCombinator = Root(-1, _SQ(2, _R(YaccParser),
-			_OP(_OR(4, 
-				T("*"), 
-				T("+"), 
-				T("?"),
+			_OP(_OR(2, 
+				T(Keywords(3, "*", "+", "?")),
 				T(_SQ(4, T("{"), T(_R(CteNatural)), _OP(_SQ(2, T(","), _OR(2, T("N"), T(_R(CteNatural))))), T("}")))
 			)))
 		);
 		YaccAction     = Root(-1, _SQ(2, _R(YaccCombinator),
-			_OP(_SQ(2, I("->"), _OR(6, 
+			_OP(_SQ(2, I("->"), _OR(5, 
 				T(_SQ(2, T("&"), T(_R(CteString)))),
 				T(_SQ(2, T("?"), T(_R(CteString)))),
 				T(_SQ(2, T("_"), T(_R(CteInt)))),
 				T(_SQ(2, T("^"), T(_R(CteInt)))),
-				T("<<"),
-				T(">>")
+				T(Keywords(2, "<<", ">>"))
 			)))
 			));
 		YaccSequence   = Name("&", false, _PL(_R(YaccAction)));
 		YaccChoice     = Name("|", false, Flat(2, _SQ(2, _R(YaccSequence), _ST(_SQ(2, I("|"), _R(YaccSequence))))));
 		YaccProduction = YaccChoice;
-		YaccRule       = Root(1, _SQ(4, T(_R(Identifier)), I("="), _R(YaccProduction), I(";")));
+		YaccRule       = Root(1, _SQ(3, T(_R(Identifier)), I("="), R(_SQ(2, _R(YaccProduction), I(";")))));
 
 		Grammar = Root(1, _SQ(7, 
 			I("GRAMMAR"), 
@@ -165,9 +161,20 @@ public:
 			_OP(Root(1, Flat(2, _SQ(2, T("SETS"),     _PL(_R(SetRule)))))), 
 			_OP(Root(1, Flat(2, _SQ(2, T("COMMENTS"), _PL(_R(LexRule)))))), 
 			_OP(Root(1, Flat(2, _SQ(2, T("SCANNER"),  _PL(_R(LexRule)))))),
-			Root(1, Flat(2, _SQ(2,     T("PARSER"),   _PL(_R(YaccRule))))), 
+			Root(1, Flat(2, _SQ(2,     T("PARSER"),   Parallel(1, Splitter(';', "()[]{}", "\"'", '#'), _R(YaccRule))))), 
 			T(EndOfInput()))
 		);
+
+		//Optimization
+		Parser** rules[] = {
+			&Separator, &Comment, &to_ignore,
+			&CteString, &CteChar, &CteNatural, &CteInt, &Identifier,
+			&SetEnumeration, &SetRange, &SetValue, &SetExpression, &SetRule,
+			&LexParser, &LexCombinator, &LexSequence, &LexChoice, &LexProduction, &LexRule,
+			&YaccParser, &YaccCombinator, &YaccAction, &YaccSequence, &YaccChoice, &YaccProduction, &YaccRule,
+			&Grammar
+		};
+		Optimize(vector<Parser**>(rules, rules + sizeof(rules) / sizeof(rules[0])));
 	}
 
 	virtual ~EBNFParser()
@@ -209,51 +216,13 @@ public:
 		delete Grammar;
 	}
 
-	virtual void Reset()
-	{
-		//Ignorable parsers
-		Separator->Reset();
-		Comment->Reset();
-		to_ignore->Reset();
-
-		//Lexical parsers
-		CteString->Reset();
-		CteChar->Reset();
-		CteNatural->Reset();
-		CteInt->Reset();
-		Identifier->Reset();
-
-		//Syntax parsers
-		//Sets section
-		SetEnumeration->Reset();
-		SetRange->Reset();
-		SetValue->Reset();
-		SetExpression->Reset();
-		SetRule->Reset();
-		//Comments, Scanner
-		LexParser->Reset();
-		LexCombinator->Reset();
-		LexSequence->Reset();
-		LexChoice->Reset();
-		LexProduction->Reset();
-		LexRule->Reset();
-		//Parser
-		YaccParser->Reset();
-		YaccCombinator->Reset();
-		YaccAction->Reset();
-		YaccSequence->Reset();
-		YaccChoice->Reset();
-		YaccProduction->Reset();
-		YaccRule->Reset();
-		Grammar->Reset();
-	}
-
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	using Parser::Parse;
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
 	{
 		_tree = 0;
-		Result r = Grammar->Parse(_s, _tree);
+		Result r = Grammar->Parse(_c, _tree);
 		if(r)
-			r.fail = Error();
+			r.Clear();
 		return r;
 	}
 };
@@ -283,52 +252,52 @@ class EBNFSemantics : public Semantics
 		return false;
 	}
 
-	Result ReservedWords(STNode* _group)
+	Error ReservedWords(STNode* _group)
 	{
 		if(!_group)
-			return Success();
+			return Error();
 
 		for(unsigned int i = 0; i < _group->Sons(); i++)
 		{
 			if(IsReservedWord(_group->Son(i)->data))
 			{
-				return Failure(Error(_group->Son(i)->data + " is a reserved word", _group->Son(i)->where));
+				return Error(_group->Son(i)->data + " is a reserved word", _group->Son(i)->where);
 			}
 		}
-		return Success();
+		return Error();
 	}
 
-	Result CheckNames(STNode* _group)
+	Error CheckNames(STNode* _group)
 	{
 		if(!_group)
-			return Success();
+			return Error();
 
 		vector<string> names;
 		for(unsigned int i = 0; i < _group->Sons(); i++)
 		{
 			if(find(names.begin(), names.end(), _group->Son(i)->data) != names.end())
 			{
-				return Failure(Error(_group->Son(i)->data + " already defined", _group->Son(i)->where));
+				return Error(_group->Son(i)->data + " already defined", _group->Son(i)->where);
 			}
 			names.push_back(_group->Son(i)->data);
 		}
-		return Success();
+		return Error();
 	}
 
-	Result IntersectNames(STNode* _group1, STNode* _group2)
+	Error IntersectNames(STNode* _group1, STNode* _group2)
 	{
 		if(!_group1 || !_group2)
-			return Success();
+			return Error();
 
 		for(unsigned int i = 0; i < _group1->Sons(); i++)
 		{
 			for(unsigned int j = 0; j < _group2->Sons(); j++)
 			{
 				if(_group1->Son(i)->data == _group2->Son(j)->data)
-					return Failure(Error(_group2->Son(j)->data + " already defined", _group2->Son(j)->where));
+					return Error(_group2->Son(j)->data + " already defined", _group2->Son(j)->where);
 			}
 		}
-		return Success();
+		return Error();
 	}
 
 	bool IsSpecialNodeName(const string& _name)
@@ -368,35 +337,35 @@ class EBNFSemantics : public Semantics
 		return false;
 	}
 
-	Result ExistsNamesRec(STNode* _ruleOrSetBody, const vector<string>& _acceptableNames)
+	Error ExistsNamesRec(STNode* _ruleOrSetBody, const vector<string>& _acceptableNames)
 	{
 		if(!_ruleOrSetBody)
-			return Success();
+			return Error();
 
 		if(IsSpecialNodeName(_ruleOrSetBody->data))
 		{
 			for(unsigned int i = 0; i < _ruleOrSetBody->Sons(); i++)
 			{
-				Result r = ExistsNamesRec(_ruleOrSetBody->Son(i), _acceptableNames);
-				if(!r) return r;
+				Error e = ExistsNamesRec(_ruleOrSetBody->Son(i), _acceptableNames);
+				if(e) return e;
 			}
 
-			return Success();
+			return Error();
 		}
 
 		if(find(_acceptableNames.begin(), _acceptableNames.end(), _ruleOrSetBody->data) == _acceptableNames.end())
 		{
 			string message = IsReservedWord(_ruleOrSetBody->data) ? (_ruleOrSetBody->data + " is a reserved word") : (_ruleOrSetBody->data + " has not been defined");
 
-			return Failure(Error(message, _ruleOrSetBody->where));
+			return Error(message, _ruleOrSetBody->where);
 		}
-		return Success();
+		return Error();
 	}
 
-	Result ExistsNames(STNode* _group, const vector<string>& _acceptableNames)
+	Error ExistsNames(STNode* _group, const vector<string>& _acceptableNames)
 	{
 		if(!_group)
-			return Success();
+			return Error();
 
 		for(unsigned int i = 0; i < _group->Sons(); i++)
 		{
@@ -404,10 +373,10 @@ class EBNFSemantics : public Semantics
 			STNode* ruleOrSet = _group->Son(i);
 
 			//data = rule or set Name | Son(0) -> Body
-			Result r = ExistsNamesRec(ruleOrSet->Son(0), _acceptableNames);
-			if(!r) return r;
+			Error e = ExistsNamesRec(ruleOrSet->Son(0), _acceptableNames);
+			if(e) return e;
 		}
-		return Success();
+		return Error();
 	}
 	
 	vector<string> CollectNames(STNode* _group)
@@ -432,10 +401,10 @@ class EBNFSemantics : public Semantics
 	}
 	
 
-	Result RepeatParsersRec(STNode* _ruleBody)
+	Error RepeatParsersRec(STNode* _ruleBody)
 	{
 		if(!_ruleBody)
-			return Success();
+			return Error();
 
 		if(_ruleBody->data[0] == '{')
 		{
@@ -450,23 +419,23 @@ class EBNFSemantics : public Semantics
 					int maxN = atoi(maxN_str.c_str());
 
 					if(minN > maxN)
-						return Failure(Error("Repeat parser bad formed (min > max)", _ruleBody->where));
+						return Error("Repeat parser bad formed (min > max)", _ruleBody->where);
 				}
 			}
 		}
 
 		for(unsigned int i = 0; i < _ruleBody->Sons(); i++)
 		{
-			Result r = RepeatParsersRec(_ruleBody->Son(i));
-			if(!r) return r;
+			Error e = RepeatParsersRec(_ruleBody->Son(i));
+			if(e) return e;
 		}
-		return Success();
+		return Error();
 	}
 
-	Result RepeatParsers(STNode* _group)
+	Error RepeatParsers(STNode* _group)
 	{
 		if(!_group)
-			return Success();
+			return Error();
 
 		for(unsigned int i = 0; i < _group->Sons(); i++)
 		{
@@ -474,20 +443,20 @@ class EBNFSemantics : public Semantics
 			STNode* rule = _group->Son(i);
 
 			//data = rule or set Name | Son(0) -> Body
-			Result r = RepeatParsersRec(rule->Son(0));
-			if(!r) return r;
+			Error e = RepeatParsersRec(rule->Son(0));
+			if(e) return e;
 		}
-		return Success();
+		return Error();
 	}
 
-	Result StartRule(STNode* _parsers)
+	Error StartRule(STNode* _parsers)
 	{
 		for(unsigned int i = 0; i < _parsers->Sons(); i++)
 		{
 			if(_parsers->Son(i)->data == "start")
-				return Success();
+				return Error();
 		}
-		return Failure(Error("\"start\" rule has not been defined"));
+		return Error("\"start\" rule has not been defined");
 	}
 
 	STNode* GetRuleNode(STNode* _group, const string& _name)
@@ -505,22 +474,22 @@ class EBNFSemantics : public Semantics
 		return 0;
 	}
 
-	Result LeftRecursionRec(const vector<string>& _ruleNames, STNode* _group, STNode* _rule)
+	Error LeftRecursionRec(const vector<string>& _ruleNames, STNode* _group, STNode* _rule)
 	{
 		if(!_rule)
-			return Success();
+			return Error();
 		
 		if(_rule->IsLeaf())
 		{
 			if(find(_ruleNames.begin(), _ruleNames.end(), _rule->data) != _ruleNames.end())
-				return Failure(Error(_rule->data + " has a left recursive derivation", _rule->where));
+				return Error(_rule->data + " has a left recursive derivation", _rule->where);
 
 			if(IsSpecialNodeName(_rule->data))
-				return Success();
+				return Error();
 
 			STNode* newRule = GetRuleNode(_group, _rule->data);
 			if(!newRule)
-				return Success();
+				return Error();
 
 			vector<string> newNames = _ruleNames;
 			newNames.push_back(newRule->data);
@@ -529,24 +498,22 @@ class EBNFSemantics : public Semantics
 
 		if(_rule->data == "|")
 		{
-			Error e;
 			for(unsigned int i = 0; i < _rule->Sons(); i++)
 			{
-				Result r = LeftRecursionRec(_ruleNames, _group, _rule->Son(i));
-				if(!r)
-					return r;
-				e += r.fail;
+				Error e = LeftRecursionRec(_ruleNames, _group, _rule->Son(i));
+				if(e)
+					return e;
 			}
-			return Success(e);
+			return Error();
 		}
 
 		return LeftRecursionRec(_ruleNames, _group, _rule->Son(0));
 	}
 
-	Result LeftRecursion(STNode* _group)
+	Error LeftRecursion(STNode* _group)
 	{
 		if(!_group)
-			return Success();
+			return Error();
 
 		for(unsigned int i = 0; i < _group->Sons(); i++)
 		{
@@ -556,16 +523,16 @@ class EBNFSemantics : public Semantics
 			vector<string> ruleNames;
 			ruleNames.push_back(rule->data);
 
-			Result r = LeftRecursionRec(ruleNames, _group, rule);
-			if(!r)
-				return r;
+			Error e = LeftRecursionRec(ruleNames, _group, rule);
+			if(e)
+				return e;
 		}
-		return Success();
+		return Error();
 	}
 
-#define VERIFY(X) r = X ; if(!r) return r
+#define VERIFY(X) e = X ; if(e) return e
 public:
-	virtual Result Check(STNode* _st)
+	virtual Error Check(STNode* _st)
 	{
 		//Obtain sub-trees with data about sets, comments, scanners and parsers
 		unsigned int index = 0;
@@ -583,7 +550,7 @@ public:
 		parsers = _st->childs[index++];
 
 		//1.- Verify no rule is named equal to a reserved word
-		Result r;
+		Error e;
 		VERIFY(ReservedWords(sets));
 		VERIFY(ReservedWords(comments));
 		VERIFY(ReservedWords(scanners));
@@ -621,7 +588,7 @@ public:
 		VERIFY(LeftRecursion(scanners));
 		VERIFY(LeftRecursion(parsers));
 
-		return Success();
+		return Error();
 	}
 };
 Semantics* EBNF_Semantics(){return new EBNFSemantics();}
@@ -711,6 +678,27 @@ class EBNFCodeGenerator : public CodeGenerator
 		return false;
 	}
 
+	unsigned int Index(STNode* _group, const string& _name)
+	{
+		for(unsigned int i = 0; i < _group->Sons(); i++)
+		{
+			if(_group->Son(i)->data == _name)
+				return i;
+		}
+		return 0;
+	}
+
+	bool IsWordChoice(STNode* _choice)
+	{
+		for(unsigned int i = 0; i < _choice->Sons(); i++)
+		{
+			STNode* son = _choice->Son(i);
+			if(!son->IsLeaf() || son->data.empty() || son->data[0] != '\"')
+				return false;
+		}
+		return true;
+	}
+
 	void GenerateRuleParser(FILE* _file, STNode* _rule, unsigned int _level, STNode* _sets, STNode* _scanner)
 	{
 		if(_rule->data == "&")
@@ -726,6 +714,17 @@ class EBNFCodeGenerator : public CodeGenerator
 			}
 			Tabs(_file, 3 + _level); fprintf(_file, ")\n");
 		}
+		else if(_rule->data == "|" && IsWordChoice(_rule))
+		{
+			//Words are matched all at once
+			Tabs(_file, 3 + _level);
+			if(_scanner)
+				fprintf(_file, "S(");
+			fprintf(_file, "Keywords(%d", _rule->Sons());
+			for(unsigned int i = 0; i < _rule->Sons(); i++)
+				fprintf(_file, ", %s", _rule->Son(i)->data.c_str());
+			fprintf(_file, _scanner ? "))\n" : ")\n");
+		}
 		else if(_rule->data == "|")
 		{
 			Tabs(_file, 3 + _level); fprintf(_file, "Choice(%d,\n", _rule->Sons());
@@ -901,7 +900,7 @@ class EBNFCodeGenerator : public CodeGenerator
 			}
 			else if(Contains(_scanner, _rule->data))
 			{
-				fprintf(_file, "S(Token(Reference(&%s)))\n", _rule->data.c_str());
+				fprintf(_file, "S(Lexed(%u, Token(Reference(&%s))))\n", Index(_scanner, _rule->data), _rule->data.c_str());
 			}
 			else
 			{
@@ -1003,6 +1002,10 @@ class EBNFCodeGenerator : public CodeGenerator
 		Tabs(_file, 1); fprintf(_file, "//Helpers\n");
 		Tabs(_file, 1); fprintf(_file, "Parser* _to_ignore;\n");
 		Tabs(_file, 1); fprintf(_file, "Parser* S(Parser* _p){return Sequence(2, Clear(Ignore(_to_ignore)), _p);}\n");
+		if(scanners)
+		{
+			Tabs(_file, 1); fprintf(_file, "vector<Parser*> _tokens; //Scanner parsers, to pre-lex the input\n");
+		}
 		
 		fprintf(_file, "\n");
 		fprintf(_file, "public:\n");
@@ -1027,12 +1030,22 @@ class EBNFCodeGenerator : public CodeGenerator
 		{
 			Tabs(_file, 2); fprintf(_file, "//Scanner parsers\n");
 			GenerateRules(_file, scanners, sets, 0);
+			GenerateStatement(_file, scanners, 2, "_tokens.push_back(Token(Reference(&%s)));\n");
 			fprintf(_file, "\n");
 		}
 
 		Tabs(_file, 2); fprintf(_file, "//Syntax parsers\n");
 		GenerateRules(_file, parsers, sets, scanners);
 
+		Tabs(_file, 2); fprintf(_file, "//Optimization\n");
+		Tabs(_file, 2); fprintf(_file, "vector<Parser**> rules;\n");
+		if(comments)
+			GenerateStatement(_file, comments, 2, "rules.push_back(&%s);\n");
+		Tabs(_file, 2); fprintf(_file, "rules.push_back(&_to_ignore);\n");
+		GenerateStatement(_file, scanners, 2, "rules.push_back(&%s);\n");
+		GenerateStatement(_file, parsers,  2, "rules.push_back(&%s);\n");
+		Tabs(_file, 2); fprintf(_file, "Optimize(rules);\n");
+
 		Tabs(_file, 1); fprintf(_file, "}\n");
 		fprintf(_file, "\n");
 
@@ -1051,6 +1064,8 @@ class EBNFCodeGenerator : public CodeGenerator
 		{
 			Tabs(_file, 2); fprintf(_file, "//Scanner parsers\n");
 			GenerateStatement(_file, scanners, 2, "delete %s;\n");
+			Tabs(_file, 2); fprintf(_file, "for(unsigned int i = 0; i < _tokens.size(); i++)\n");
+			Tabs(_file, 3); fprintf(_file, "delete _tokens[i];\n");
 			fprintf(_file, "\n");
 		}
 		Tabs(_file, 2); fprintf(_file, "//Syntax parsers\n");
@@ -1058,31 +1073,15 @@ class EBNFCodeGenerator : public CodeGenerator
 		Tabs(_file, 1); fprintf(_file, "}\n");
 		fprintf(_file, "\n");
 
-		//Reset
-		Tabs(_file, 1); fprintf(_file, "virtual void Reset()\n");
+		//Parse
+		Tabs(_file, 1); fprintf(_file, "using Parser::Parse;\n");
+		Tabs(_file, 1); fprintf(_file, "virtual Result Parse(ParseContext& _c, STNode*& _tree)\n");
 		Tabs(_file, 1); fprintf(_file, "{\n");
-		Tabs(_file, 2); fprintf(_file, "//Ignorable parsers\n");
-		if(comments)
-		{
-			GenerateStatement(_file, comments, 2, "%s->Reset();\n");			
-		}
-		Tabs(_file, 2); fprintf(_file, "delete _to_ignore;\n");
-		fprintf(_file, "\n");
 		if(scanners)
 		{
-			Tabs(_file, 2); fprintf(_file, "//Scanner parsers\n");
-			GenerateStatement(_file, scanners, 2, "%s->Reset();\n");
-			fprintf(_file, "\n");
+			Tabs(_file, 2); fprintf(_file, "_c.Lex(_to_ignore, _tokens);\n");
 		}
-		Tabs(_file, 2); fprintf(_file, "//Syntax parsers\n");
-		GenerateStatement(_file, parsers,  2,  "%s->Reset();\n");
-		Tabs(_file, 1); fprintf(_file, "}\n");
-		fprintf(_file, "\n");
-
-		//Parse
-		Tabs(_file, 1); fprintf(_file, "virtual Result Parse(Stream* _s, STNode*& _tree)\n");
-		Tabs(_file, 1); fprintf(_file, "{\n");
-		Tabs(_file, 2); fprintf(_file, "Result r = start->Parse(_s, _tree);\n");
+		Tabs(_file, 2); fprintf(_file, "Result r = start->Parse(_c, _tree);\n");
 		Tabs(_file, 2); fprintf(_file, "if(r)\n");
 		Tabs(_file, 3); fprintf(_file, "r.Clear();\n");
 		Tabs(_file, 2); fprintf(_file, "return r;\n");
@@ -1108,6 +1107,77 @@ class EBNFCodeGenerator : public CodeGenerator
 		fprintf(_file, "#endif\n");
 	}
 
+	void GenerateMain(FILE* _file, const string& _name)
+	{
+		fprintf(_file, "//COMMAND LINE\n");
+		fprintf(_file, "//Build with %s_MAIN defined to get a parser with a command line\n", _name.c_str());
+		fprintf(_file, "#ifdef %s_MAIN\n", _name.c_str());
+		fprintf(_file, "#include <cstdlib>\n");
+		fprintf(_file, "#include <iostream>\n");
+		fprintf(_file, "\n");
+		fprintf(_file, "static void Failure(const Error& _e)\n");
+		fprintf(_file, "{\n");
+		Tabs(_file, 1); fprintf(_file, "cout << \"Failure at (\" << _e.where.row << \", \" << _e.where.column << \")\" << endl;\n");
+		Tabs(_file, 1); fprintf(_file, "for(unsigned int i = 0; i < _e.expected.size(); i++)\n");
+		Tabs(_file, 2); fprintf(_file, "cout << \"\\tExpected: [\" << _e.expected[i] << \"]\" << endl;\n");
+		fprintf(_file, "}\n");
+		fprintf(_file, "\n");
+		fprintf(_file, "int main(int argc, char* argv[])\n");
+		fprintf(_file, "{\n");
+		Tabs(_file, 1); fprintf(_file, "if(argc < 2)\n");
+		Tabs(_file, 1); fprintf(_file, "{\n");
+		Tabs(_file, 2); fprintf(_file, "cout << \"Use: \" << argv[0] << \" <file> [-l] [-t <threads>]\" << endl;\n");
+		Tabs(_file, 2); fprintf(_file, "cout << \"\\t<file> = file to parse\" << endl;\n");
+		Tabs(_file, 2); fprintf(_file, "cout << \"\\t-l = Parses each line of the file as an independent record, in parallel\" << endl;\n");
+		Tabs(_file, 2); fprintf(_file, "cout << \"\\t-t = Threads to use with -l (default, one per core)\" << endl;\n");
+		Tabs(_file, 2); fprintf(_file, "return 0;\n");
+		Tabs(_file, 1); fprintf(_file, "}\n");
+		fprintf(_file, "\n");
+		Tabs(_file, 1); fprintf(_file, "bool records = false;\n");
+		Tabs(_file, 1); fprintf(_file, "unsigned int threads = 0;\n");
+		Tabs(_file, 1); fprintf(_file, "for(int i = 2; i < argc; i++)\n");
+		Tabs(_file, 1); fprintf(_file, "{\n");
+		Tabs(_file, 2); fprintf(_file, "if(argv[i] == string(\"-l\"))\n");
+		Tabs(_file, 3); fprintf(_file, "records = true;\n");
+		Tabs(_file, 2); fprintf(_file, "else if(argv[i] == string(\"-t\") && i + 1 < argc)\n");
+		Tabs(_file, 3); fprintf(_file, "threads = atoi(argv[++i]);\n");
+		Tabs(_file, 1); fprintf(_file, "}\n");
+		fprintf(_file, "\n");
+		Tabs(_file, 1); fprintf(_file, "Parser* parser = %s_Parser();\n", _name.c_str());
+		Tabs(_file, 1); fprintf(_file, "TreeEmitter* emitter = TextEmitter(true);\n");
+		fprintf(_file, "\n");
+		Tabs(_file, 1); fprintf(_file, "if(records)\n");
+		Tabs(_file, 1); fprintf(_file, "{\n");
+		Tabs(_file, 2); fprintf(_file, "vector<Parsed> parsed = ParseRecordFile(parser, argv[1], threads);\n");
+		Tabs(_file, 2); fprintf(_file, "for(unsigned int i = 0; i < parsed.size(); i++)\n");
+		Tabs(_file, 2); fprintf(_file, "{\n");
+		Tabs(_file, 3); fprintf(_file, "if(parsed[i].result)\n");
+		Tabs(_file, 4); fprintf(_file, "emitter->Emit(parsed[i].tree, stdout);\n");
+		Tabs(_file, 3); fprintf(_file, "else\n");
+		Tabs(_file, 4); fprintf(_file, "Failure(parsed[i].error);\n");
+		Tabs(_file, 3); fprintf(_file, "delete parsed[i].tree;\n");
+		Tabs(_file, 2); fprintf(_file, "}\n");
+		Tabs(_file, 2); fprintf(_file, "return 0;\n");
+		Tabs(_file, 1); fprintf(_file, "}\n");
+		fprintf(_file, "\n");
+		Tabs(_file, 1); fprintf(_file, "Stream* s = FileStream(argv[1]);\n");
+		Tabs(_file, 1); fprintf(_file, "if(!s)\n");
+		Tabs(_file, 1); fprintf(_file, "{\n");
+		Tabs(_file, 2); fprintf(_file, "cout << \"Unable to open: \" << argv[1] << endl;\n");
+		Tabs(_file, 2); fprintf(_file, "return 0;\n");
+		Tabs(_file, 1); fprintf(_file, "}\n");
+		fprintf(_file, "\n");
+		Tabs(_file, 1); fprintf(_file, "STNode* tree = 0;\n");
+		Tabs(_file, 1); fprintf(_file, "Error e;\n");
+		Tabs(_file, 1); fprintf(_file, "if(parser->Parse(s, tree, e))\n");
+		Tabs(_file, 2); fprintf(_file, "emitter->Emit(tree, stdout);\n");
+		Tabs(_file, 1); fprintf(_file, "else\n");
+		Tabs(_file, 2); fprintf(_file, "Failure(e);\n");
+		Tabs(_file, 1); fprintf(_file, "return 0;\n");
+		fprintf(_file, "}\n");
+		fprintf(_file, "#endif\n");
+	}
+
 	void GenerateBody(FILE* _file, STNode* _ast)
 	{
 		fprintf(_file, "#include \"%s.h\"\n", _ast->data.c_str());
@@ -1115,10 +1185,11 @@ class EBNFCodeGenerator : public CodeGenerator
 		fprintf(_file, "//PARSER\n");
 		GenerateParser(_file, _ast);
 		fprintf(_file, "\n");
+		GenerateMain(_file, _ast->data);
 	}
 
 public:
-	virtual Result Generate(STNode* _st, const string& _path)
+	virtual Error Generate(STNode* _st, const string& _path)
 	{
 		FILE* file = 0;
 		string fileName = "";
@@ -1127,7 +1198,7 @@ public:
 		fileName = _path + _st->data + ".h";
 		fopen_s(&file, fileName.c_str(), "w");
 		if(!file)
-			return Failure(Error(fileName + " could not be open"));
+			return Error(fileName + " could not be open");
 		GenerateHeader(file, _st->data);
 		fclose(file);
 
@@ -1135,11 +1206,11 @@ public:
 		fileName = _path + _st->data + ".cpp";
 		fopen_s(&file, fileName.c_str(), "w");
 		if(!file)
-			return Failure(Error(fileName + " could not be open"));
+			return Error(fileName + " could not be open");
 		GenerateBody(file, _st);
 		fclose(file);
 
-		return Success();
+		return Error();
 	}
 };
 
@@ -8,7 +8,11 @@
 class Semantics
 {
 public:
-	virtual Result Check(STNode* _st) = 0;
+	/**
+	* @brief Verifies the ST.
+	* @return Error found, if any.
+	*/
+	virtual Error Check(STNode* _st) = 0;
 };
 
 /**
@@ -17,7 +21,11 @@ public:
 class CodeGenerator
 {
 public:
-	virtual Result Generate(STNode* _st, const string& _path) = 0;
+	/**
+	* @brief Generates code from the ST into _path.
+	* @return Error found, if any.
+	*/
+	virtual Error Generate(STNode* _st, const string& _path) = 0;
 };
 
 Parser*			EBNF_Parser();
@@ -1,8 +1,26 @@
 #include "Languages.h"
 #include <cstdarg>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <stack>
 #include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 Position::Position(unsigned int _row, unsigned int _column)
@@ -36,12 +54,15 @@ bool Position::operator!=(const Position& _p) const
 */
 class StreamImpl : public Stream
 {
-	const char*  input;
-	size_t       size;
+protected:
+	mutable const char* input; //!< Mutable, as it grows while read on input still arriving. @see FedStream
+	mutable size_t      size;
+private:
 	bool         deleteInput;
 
 	unsigned int head;
 	Position     where;
+	Position     origin; //!< Position of the first char
 
 	mutable map<Position, unsigned int> cache;
 	void AddToCache() const
@@ -61,12 +82,12 @@ class StreamImpl : public Stream
 		return false;
 	}
 public:
-	StreamImpl(const char* _input, size_t _size, bool _deleteInput)
-		: input(_input), size(_size), deleteInput(_deleteInput), head(0), where(Position(1, 1))
+	StreamImpl(const char* _input, size_t _size, bool _deleteInput, const Position& _origin = Position(1, 1))
+		: input(_input), size(_size), deleteInput(_deleteInput), head(0), where(_origin), origin(_origin)
 	{
 	}
 
-	StreamImpl::~StreamImpl()
+	virtual ~StreamImpl()
 	{
 		if(deleteInput)
 			free((void*)input);
@@ -103,6 +124,35 @@ public:
 		return head >= size;
 	}
 
+	size_t Offset() const
+	{
+		return head;
+	}
+
+	virtual const char* Peek(unsigned int _size) const
+	{
+		if(size - head < _size)
+			return 0;
+
+		return input + head;
+	}
+
+	virtual const char* Rest(size_t& _size) const
+	{
+		_size = size - head;
+		return input + head;
+	}
+
+	virtual bool Skip(size_t _count, const Position& _to)
+	{
+		if(size - head < _count)
+			return false;
+
+		head += static_cast<unsigned int>(_count);
+		where = _to;
+		return true;
+	}
+
 	virtual Position Where() const
 	{
 		AddToCache();
@@ -119,10 +169,10 @@ public:
 		unsigned savedHead = head;
 
 		//Start
-		where = Position(1, 1);
+		where = origin;
 		head = 0;
 
-		while(where < _newPosition)
+		while(where < _newPosition && !AtEnd())
 			Next();
 
 		if(where != _newPosition)
@@ -138,12 +188,211 @@ public:
 
 Stream::~Stream() {}
 
-Stream* MemoryStream(const char* _input, size_t _size)
+const char* Stream::Peek(unsigned int) const
 {
-	return new StreamImpl(_input, _size, false);
+	return 0;
 }
 
-Stream* FileStream(const char* _fileName)
+const char* Stream::Rest(size_t& _size) const
+{
+	_size = 0;
+	return 0;
+}
+
+bool Stream::Skip(size_t _count, const Position&)
+{
+	for(; _count && !AtEnd(); _count--)
+		Next();
+
+	return !_count;
+}
+
+/**
+* @brief Stream on a text which can be edited between parses, recording the furthest position examined by parsers.
+* Positions are found from an index of lines, so going anywhere is immediate. The text before a position can be dropped, and those
+* after it stay the same. @see IncrementalParse, AppendParse
+*/
+class EditableStream : public Stream
+{
+	string			 text;
+	vector<size_t>	 lines;	 //!< Offset of the first char of each line, the first one from origin
+	Position		 origin; //!< Of the first char of text
+
+	size_t			 head;
+	Position		 where;
+	mutable Position reach;
+
+	void Index()
+	{
+		lines.assign(1, 0);
+		for(size_t i = 0; (i = text.find('\n', i)) != string::npos; i++)
+			lines.push_back(i + 1);
+	}
+	/**
+	* @brief Column of the first char of the line with that index.
+	*/
+	unsigned int First(size_t _line) const
+	{
+		return _line ? 1 : origin.column;
+	}
+public:
+	EditableStream(const string& _text)
+		: text(_text), origin(1, 1), head(0), where(1, 1), reach(1, 1)
+	{
+		Index();
+	}
+
+	virtual char Get() const
+	{
+		if(AtEnd())
+			return 0;
+
+		return text[head];
+	}
+	virtual void Next()
+	{
+		if(AtEnd())
+			return;
+
+		if(text[head] == '\n')
+		{
+			where.row++;
+			where.column = 1;
+		}
+		else
+		{
+			where.column++;
+		}
+
+		head++;
+	}
+	virtual bool AtEnd() const
+	{
+		if(reach < where)
+			reach = where;
+
+		return head >= text.size();
+	}
+	virtual Position Where() const
+	{
+		return where;
+	}
+	virtual const char* Peek(unsigned int _size) const
+	{
+		if(text.size() - head < _size)
+			return 0;
+
+		if(_size)
+		{
+			Position last = At(head + _size - 1);
+			if(reach < last)
+				reach = last;
+		}
+		return text.data() + head;
+	}
+	virtual bool Goto(const Position& _newPosition)
+	{
+		if(_newPosition.row < origin.row || _newPosition.row - origin.row >= lines.size())
+			return false;
+
+		size_t line = _newPosition.row - origin.row;
+		if(_newPosition.column < First(line))
+			return false;
+
+		size_t offset = lines[line] + _newPosition.column - First(line);
+		size_t end = (line + 1 < lines.size()) ? lines[line + 1] - 1 : text.size();
+		if(offset > end)
+			return false;
+
+		head = offset;
+		where = _newPosition;
+		return true;
+	}
+
+	/**
+	* @brief Text from the first char not dropped.
+	*/
+	const string& Text() const
+	{
+		return text;
+	}
+	/**
+	* @brief Position of the char at _offset in Text.
+	*/
+	Position At(size_t _offset) const
+	{
+		size_t line = upper_bound(lines.begin(), lines.end(), _offset) - lines.begin() - 1;
+		return Position(origin.row + static_cast<unsigned int>(line), static_cast<unsigned int>(_offset - lines[line] + First(line)));
+	}
+	void Edit(size_t _offset, size_t _removed, const string& _inserted)
+	{
+		text.replace(_offset, _removed, _inserted);
+		Index();
+		Goto(origin);
+	}
+	/**
+	* @brief Drops the text before _where, which can't be read any more. The head stays where it was, if not dropped.
+	*/
+	void Drop(const Position& _where)
+	{
+		Position current = where;
+		if(!Goto(_where) || !head)
+		{
+			Goto(current);
+			return;
+		}
+
+		size_t dropped = head;
+		size_t line = _where.row - origin.row;
+		text.erase(0, dropped);
+		lines.erase(lines.begin(), lines.begin() + line);
+		for(unsigned int i = 0; i < lines.size(); i++)
+			lines[i] = i ? lines[i] - dropped : 0;
+		origin = _where;
+
+		if(!Goto(current))
+			Goto(origin);
+	}
+	void Append(const char* _data, size_t _size)
+	{
+		size_t size = text.size();
+		text.append(_data, _size);
+		for(size_t i = size; (i = text.find('\n', i)) != string::npos; i++)
+			lines.push_back(i + 1);
+	}
+
+	/**
+	* @brief Starts tracking what is examined from _from on. Returns how far it was examined so far, to be restored with Examined.
+	*/
+	Position Examine(const Position& _from)
+	{
+		Position examined = reach;
+		reach = _from;
+		return examined;
+	}
+	void Examined(const Position& _where)
+	{
+		if(reach < _where)
+			reach = _where;
+	}
+	Position Reach() const
+	{
+		return reach;
+	}
+};
+
+Stream* MemoryStream(const char* _first, const char* _last)
+{
+	return new StreamImpl(_first, _last - _first, false);
+}
+
+/**
+* @brief Reads a whole file into memory.
+* @param _fileName [in]  Path of the file to read from.
+* @param _size     [out] Number of bytes read.
+* @return A null terminated buffer (to be released with free) with the file contents. 0 if the file could not be read.
+*/
+static char* ReadFile(const char* _fileName, size_t& _size)
 {
 	FILE* f = 0;
 	fopen_s(&f, _fileName, "rb");
@@ -179,6 +428,99 @@ Stream* FileStream(const char* _fileName)
 
 	fclose(f);
 
+	_size = size;
+	return input;
+}
+
+/**
+* @brief A whole file mapped into memory, read only, to be read in place. A file which can't be mapped, as a pipe, is read instead.
+*/
+class MappedFile
+{
+	const char* data;
+	size_t		size;
+	char*		contents; //!< Read, if not mapped.
+#ifdef _WIN32
+	void Map(const char* _fileName)
+	{
+		HANDLE file = CreateFileA(_fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if(file == INVALID_HANDLE_VALUE)
+			return;
+
+		LARGE_INTEGER length;
+		if(GetFileSizeEx(file, &length) && length.QuadPart > 0 && (unsigned long long)length.QuadPart <= (size_t)-1)
+		{
+			//The view keeps the mapping open
+			HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+			if(mapping)
+			{
+				data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				size = data ? (size_t)length.QuadPart : 0;
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+	}
+	void Unmap()
+	{
+		if(data)
+			UnmapViewOfFile(data);
+	}
+#else
+	void Map(const char* _fileName)
+	{
+		int file = open(_fileName, O_RDONLY);
+		if(file < 0)
+			return;
+
+		struct stat status;
+		if(!fstat(file, &status) && S_ISREG(status.st_mode) && status.st_size > 0)
+		{
+			void* mapped = mmap(0, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if(mapped != MAP_FAILED)
+			{
+				data = (const char*)mapped;
+				size = (size_t)status.st_size;
+			}
+		}
+		close(file);
+	}
+	void Unmap()
+	{
+		if(data)
+			munmap((void*)data, size);
+	}
+#endif
+public:
+	MappedFile(const char* _fileName)
+		: data(0), size(0), contents(0)
+	{
+		Map(_fileName);
+		if(data)
+			return;
+
+		contents = ReadFile(_fileName, size);
+		data = contents;
+	}
+	~MappedFile()
+	{
+		if(contents)
+			free(contents);
+		else
+			Unmap();
+	}
+
+	const char* Data() const {return data;} //!< 0 if the file could not be read.
+	size_t		Size() const {return size;}
+};
+
+Stream* FileStream(const char* _fileName)
+{
+	size_t size = 0;
+	char* input = ReadFile(_fileName, size);
+	if(!input)
+		return 0;
+
 	StreamImpl* s = new StreamImpl(input, size, true);
 	if(!s)
 	{
@@ -298,1094 +640,5812 @@ static void PostWalk_Impl(STNode* _root, unsigned int _level, TreeVisitor* _visi
 void PostWalk(STNode* _root, TreeVisitor* _visitor) {PostWalk_Impl(_root, 0, _visitor);}
 
 
-
-
-
-
-
-bool Set::contains(const vector<char>& _set, const char& _element) const
+bool Equal(STNode* _a, STNode* _b)
 {
-	return find(_set.begin(), _set.end(), _element) != _set.end();
-}
-
-Set::Set(){}
+	if(_a == _b)
+		return true;
 
-Set::Set(char _c)
-{
-	elements.push_back(_c);
-}
+	if(!_a || !_b)
+		return false;
 
-Set Set::operator+(const Set& _set) const
-{
-	//Union starts with one set
-	Set union_set(*this);
+	if(_a->data != _b->data || _a->Sons() != _b->Sons())
+		return false;
 
-	for (size_t i = 0; i < _set.elements.size(); i++)
+	for(unsigned int i = 0; i < _a->Sons(); i++)
 	{
-		if(!contains(elements, _set.elements[i]))
-		{
-			//Element NOT FOUND, so add to union
-			union_set.elements.push_back(_set.elements[i]);
-		}
+		if(!Equal(_a->childs[i], _b->childs[i]))
+			return false;
 	}
-
-	return union_set;
+	return true;
 }
 
-Set Set::operator*(const Set& _set) const
+STNodeTable::~STNodeTable() {}
+
+/**
+* @brief STNodeTable Implementation.
+* Nodes are bucketed by a hash of their data and the addresses of their (already interned) sons,
+* so two candidates are equal if their data and their son's addresses are.
+*/
+class STNodeTableImpl : public STNodeTable
 {
-	//Intersection starts empty
-	Set intersection_set;
+	unordered_multimap<size_t, STNode*> nodes;
+	unordered_set<STNode*>				interned;
 
-	for (size_t i = 0; i < _set.elements.size(); i++)
+	size_t Hash(STNode* _node)
 	{
-		if(contains(elements, _set.elements[i]))
+		size_t h = hash<string>()(_node->data);
+		for(unsigned int i = 0; i < _node->Sons(); i++)
+			h = h * 31 + hash<STNode*>()(_node->childs[i]);
+		return h;
+	}
+public:
+	virtual ~STNodeTableImpl()
+	{
+		//Every son is also interned, so nodes are deleted one by one
+		for(unordered_multimap<size_t, STNode*>::iterator i = nodes.begin(); i != nodes.end(); i++)
 		{
-			//Element FOUND, so add to intersection
-			intersection_set.elements.push_back(_set.elements[i]);
+			i->second->UnlinkAll();
+			delete i->second;
 		}
 	}
 
-	return intersection_set;
-}
+	virtual STNode* Intern(STNode* _tree)
+	{
+		if(!_tree)
+			return 0;
 
-Set Set::operator-(const Set& _set) const
-{
-	//Intersection starts empty
-	Set difference_set;
+		//Shared subtrees are not walked again
+		if(interned.find(_tree) != interned.end())
+			return _tree;
 
-	for (size_t i = 0; i < elements.size(); i++)
-	{
-		if(!contains(_set.elements, elements[i]))
+		for(unsigned int i = 0; i < _tree->Sons(); i++)
+			_tree->childs[i] = Intern(_tree->childs[i]);
+
+		size_t h = Hash(_tree);
+		pair<unordered_multimap<size_t, STNode*>::iterator, unordered_multimap<size_t, STNode*>::iterator> candidates = nodes.equal_range(h);
+		for(unordered_multimap<size_t, STNode*>::iterator i = candidates.first; i != candidates.second; i++)
 		{
-			//Element NOT FOUND, so add to difference
-			difference_set.elements.push_back(_set.elements[i]);
+			STNode* candidate = i->second;
+			if(candidate->data == _tree->data && candidate->childs == _tree->childs)
+			{
+				//Sons are shared with the candidate
+				_tree->UnlinkAll();
+				delete _tree;
+				return candidate;
+			}
 		}
-	}
 
-	return difference_set;
-}
-
-bool Set::operator<(const Set& _set) const
-{
-	//Test this contained in _set
-	for (size_t i = 0; i < elements.size(); i++)
-	{
-		if(!contains(_set.elements, elements[i]))
-			return false;
+		nodes.insert(pair<size_t, STNode*>(h, _tree));
+		interned.insert(_tree);
+		return _tree;
 	}
-	return true;
-}
 
-bool Set::operator>(const Set& _set) const
-{
-	//Test _set contained in this
-	for (size_t i = 0; i < _set.elements.size(); i++)
+	virtual unsigned int Size()
 	{
-		if(!contains(elements, _set.elements[i]))
-			return false;
+		return nodes.size();
 	}
-	return true;
-}
+};
 
-bool Set::operator==(const Set& _set) const
+STNodeTable* HashConsing()
 {
-	//Equal is _set contained in *this, and *this contained in _set
-	return (_set < *this) && (*this < _set);
+	return new STNodeTableImpl();
 }
 
-bool Set::operator!=(const Set& _set) const
-{
-	return ! operator==(_set);
-}
 
-string Set::Name()
+
+/**
+* @brief Binary tree format. Every field is a 32 bits unsigned integer in the byte order of the host that wrote it, and every part is 4 bytes aligned:
+* [ImageHeader][ImageNode x nodes][son index x sons][ImageString x strings][characters]
+* Nodes are stored in preorder, so root is node 0, and the sons of a node are a range of the son index array.
+* A shared subtree is stored once, after all of its parents, so every son has a greater index than its parent.
+* Strings are null terminated inside the characters array.
+* An image written on a host of the other byte order has its magic swapped, so it is rejected as invalid.
+*/
+struct ImageHeader
 {
-	string result = "[";
-	for(unsigned int i = 0; i < elements.size(); i++)
-		result += elements[i];
-	result += "]";
-	return result;
-}
+	unsigned int magic;
+	unsigned int version;
+	unsigned int nodes;
+	unsigned int sons;
+	unsigned int strings;
+	unsigned int characters;
+};
 
-Set Range(char _begin, char _end)
+struct ImageNode
 {
-	Set result;
-	for (char i = _begin; i <= _end; i++)
-		result = result + i;
-	return result;
-}
+	unsigned int data;     //!< Index in the string table.
+	unsigned int row;
+	unsigned int column;
+	unsigned int firstSon; //!< Index in the son index array.
+	unsigned int sons;
+};
 
-Set Enumeration(unsigned int _number, ...)
+struct ImageString
 {
-	va_list arguments;                     
-	Set result;
+	unsigned int offset;   //!< Index in the characters array.
+	unsigned int size;     //!< Size without the ending null.
+};
 
-	va_start(arguments, _number);           
-	for(unsigned int i = 0; i < _number; i++)
+static const unsigned int IMAGE_MAGIC   = 0x31425453; //"STB1"
+static const unsigned int IMAGE_VERSION = 1;
+
+/**
+* @brief Lays out a tree in the binary format.
+* Nodes are numbered by address, so subtrees shared in a STNodeTable are written once.
+* A node is numbered once all its parents are, taking first the last node reached: that is preorder for a tree.
+*/
+class ImageWriter
+{
+	vector<ImageNode>				nodes;
+	vector<unsigned int>			sons;
+	vector<ImageString>				strings;
+	string							characters;
+	unordered_map<STNode*, unsigned int> nodeIndexes;
+	unordered_map<string, unsigned int>  stringIndexes;
+
+	unsigned int AddString(const string& _data)
 	{
-		result = result + va_arg(arguments, char); 
+		unordered_map<string, unsigned int>::iterator i = stringIndexes.find(_data);
+		if(i != stringIndexes.end())
+			return i->second;
+
+		ImageString s;
+		s.offset = characters.size();
+		s.size   = _data.size();
+		characters += _data;
+		characters += '\0';
+
+		unsigned int index = strings.size();
+		strings.push_back(s);
+		stringIndexes.insert(pair<string, unsigned int>(_data, index));
+		return index;
 	}
-	va_end(arguments);
-		
-	return result;
-}
 
+	void AddTree(STNode* _tree)
+	{
+		//Count the parents of every node
+		unordered_map<STNode*, unsigned int> parents;
+		vector<STNode*> pending(1, _tree);
+		parents[_tree] = 0;
+		while(!pending.empty())
+		{
+			STNode* node = pending.back();
+			pending.pop_back();
+			for(unsigned int i = 0; i < node->Sons(); i++)
+			{
+				if(!parents[node->childs[i]]++)
+					pending.push_back(node->childs[i]);
+			}
+		}
 
+		//Number nodes whose parents are all numbered, sons pushed backwards so that the first is taken first
+		vector<STNode*> order;
+		pending.push_back(_tree);
+		while(!pending.empty())
+		{
+			STNode* node = pending.back();
+			pending.pop_back();
+			nodeIndexes.insert(pair<STNode*, unsigned int>(node, static_cast<unsigned int>(order.size())));
+			order.push_back(node);
+			for(unsigned int i = node->Sons(); i > 0; i--)
+			{
+				if(!--parents[node->childs[i - 1]])
+					pending.push_back(node->childs[i - 1]);
+			}
+		}
 
+		for(unsigned int i = 0; i < order.size(); i++)
+		{
+			STNode* node = order[i];
+
+			ImageNode n;
+			n.data     = AddString(node->data);
+			n.row      = node->where.row;
+			n.column   = node->where.column;
+			n.firstSon = sons.size();
+			n.sons     = node->Sons();
+			nodes.push_back(n);
+
+			for(unsigned int j = 0; j < node->Sons(); j++)
+				sons.push_back(nodeIndexes[node->childs[j]]);
+		}
+	}
 
+	static size_t Align(size_t _size)
+	{
+		return (_size + 3) & ~(size_t)3;
+	}
 
-Error::Error(const string& _expected, const Position& _where)
-	: where(_where)
-{
-	expected.push_back(_expected);
-}
+public:
+	ImageWriter(STNode* _tree)
+	{
+		if(_tree)
+			AddTree(_tree);
+	}
 
-Error& Error::operator+=(const Error& _error)
-{
-	//Replace
-	if(_error.where > where)
+	bool Write(FILE* _file)
 	{
-		*this = _error;
+		ImageHeader header;
+		header.magic      = IMAGE_MAGIC;
+		header.version    = IMAGE_VERSION;
+		header.nodes      = nodes.size();
+		header.sons       = sons.size();
+		header.strings    = strings.size();
+		header.characters = Align(characters.size());
+		characters.resize(header.characters, '\0');
+
+		if(fwrite(&header, sizeof(header), 1, _file) != 1)
+			return false;
+		if(nodes.size() && fwrite(&nodes[0], sizeof(ImageNode), nodes.size(), _file) != nodes.size())
+			return false;
+		if(sons.size() && fwrite(&sons[0], sizeof(unsigned int), sons.size(), _file) != sons.size())
+			return false;
+		if(strings.size() && fwrite(&strings[0], sizeof(ImageString), strings.size(), _file) != strings.size())
+			return false;
+		if(characters.size() && fwrite(characters.data(), 1, characters.size(), _file) != characters.size())
+			return false;
+		return true;
 	}
-	
-	//Add
-	if(_error.where == where)
+
+	/**
+	* @brief Size of the image, in bytes.
+	*/
+	unsigned long long Bytes()
 	{
-		for(unsigned int i = 0; i < _error.expected.size(); i++)
+		return sizeof(ImageHeader) + 
+			(unsigned long long)nodes.size()   * sizeof(ImageNode) + 
+			(unsigned long long)sons.size()    * sizeof(unsigned int) + 
+			(unsigned long long)strings.size() * sizeof(ImageString) + 
+			Align(characters.size());
+	}
+};
+
+STImage::~STImage() {}
+
+/**
+* @brief STImage Implementation.
+* Accessors read the arrays in place.
+*/
+class STImageImpl : public STImage
+{
+	const char*			input;
+	bool				deleteInput;
+
+	const ImageHeader*	header;
+	const ImageNode*	nodes;
+	const unsigned int*	sons;
+	const ImageString*	strings;
+	const char*			characters;
+
+	struct Frame
+	{
+		STNode*		 node;
+		unsigned int image;
+		unsigned int next;
+	};
+
+	STNode* Build(unsigned int _node)
+	{
+		STNode* root = new STNode(Where(_node), Data(_node));
+		Frame first = {root, _node, 0};
+		vector<Frame> stack(1, first);
+		while(!stack.empty())
 		{
-			if(find(expected.begin(), expected.end(), _error.expected[i]) == expected.end()) 
-				expected.push_back(_error.expected[i]);
+			Frame& top = stack.back();
+			if(top.next == Sons(top.image))
+			{
+				stack.pop_back();
+				continue;
+			}
+
+			unsigned int son = Son(top.image, top.next++);
+			STNode* node = new STNode(Where(son), Data(son));
+			top.node->AddSon(node);
+
+			Frame frame = {node, son, 0};
+			stack.push_back(frame);
 		}
+		return root;
+	}
+public:
+	STImageImpl(const char* _input, bool _deleteInput)
+		: input(_input), deleteInput(_deleteInput)
+	{
+		header     = (const ImageHeader*)input;
+		nodes      = (const ImageNode*)(header + 1);
+		sons       = (const unsigned int*)(nodes + header->nodes);
+		strings    = (const ImageString*)(sons + header->sons);
+		characters = (const char*)(strings + header->strings);
+	}
+	virtual ~STImageImpl()
+	{
+		if(deleteInput)
+			free((void*)input);
 	}
 
-	return *this;
-}
+	/**
+	* @brief Checks the block holds an image of the current version, the arrays fit into it and every index is in range.
+	* Sons must have greater indexes than their parents, so an image can't hold a cycle.
+	*/
+	static bool IsValid(const char* _input, size_t _size)
+	{
+		if(_size < sizeof(ImageHeader))
+			return false;
 
-Error::operator bool()
-{
-	return where != Position() || !expected.empty();
-}
+		const ImageHeader* h = (const ImageHeader*)_input;
+		if(h->magic != IMAGE_MAGIC || h->version != IMAGE_VERSION)
+			return false;
 
+		unsigned long long needed = sizeof(ImageHeader) + 
+			(unsigned long long)h->nodes   * sizeof(ImageNode) + 
+			(unsigned long long)h->sons    * sizeof(unsigned int) + 
+			(unsigned long long)h->strings * sizeof(ImageString) + 
+			h->characters;
+		if(needed > _size)
+			return false;
 
+		const ImageNode*	n = (const ImageNode*)(h + 1);
+		const unsigned int*	sons = (const unsigned int*)(n + h->nodes);
+		const ImageString*	strings = (const ImageString*)(sons + h->sons);
+		const char*			characters = (const char*)(strings + h->strings);
 
-Result::Result(bool _match, const Error& _fail)
-	: match(_match), fail(_fail)
-{}
+		for(unsigned int i = 0; i < h->strings; i++)
+		{
+			unsigned long long end = (unsigned long long)strings[i].offset + strings[i].size;
+			if(end >= h->characters || characters[end] != '\0')
+				return false;
+		}
 
-Result::operator bool()
-{
-	return match;
-}
+		for(unsigned int i = 0; i < h->nodes; i++)
+		{
+			if(n[i].data >= h->strings)
+				return false;
+			if((unsigned long long)n[i].firstSon + n[i].sons > h->sons)
+				return false;
 
-Result Result::operator!()
-{
-	return Result(!match, fail);
-}
+			for(unsigned int j = 0; j < n[i].sons; j++)
+			{
+				unsigned int son = sons[n[i].firstSon + j];
+				if(son <= i || son >= h->nodes)
+					return false;
+			}
+		}
+		return true;
+	}
 
-Result Result::Clear()
+	virtual unsigned int Nodes()
+	{
+		return header->nodes;
+	}
+	virtual const char* Data(unsigned int _node)
+	{
+		if(_node >= header->nodes)
+			return "";
+		return characters + strings[nodes[_node].data].offset;
+	}
+	virtual Position Where(unsigned int _node)
+	{
+		if(_node >= header->nodes)
+			return Position();
+		return Position(nodes[_node].row, nodes[_node].column);
+	}
+	virtual unsigned int Sons(unsigned int _node)
+	{
+		if(_node >= header->nodes)
+			return 0;
+		return nodes[_node].sons;
+	}
+	virtual unsigned int Son(unsigned int _node, unsigned int _index)
+	{
+		if(_index >= Sons(_node))
+			return header->nodes;
+		return sons[nodes[_node].firstSon + _index];
+	}
+	virtual STNode* Tree()
+	{
+		return Nodes() ? Build(0) : 0;
+	}
+};
+
+bool SaveTree(STNode* _tree, const char* _fileName)
 {
-	fail = Error();
-	return *this;
+	FILE* f = 0;
+	fopen_s(&f, _fileName, "wb");
+	if(!f)
+		return false;
+
+	ImageWriter w(_tree);
+	bool written = w.Write(f);
+
+	fclose(f);
+	return written;
 }
 
-Result Success(const Error& _fail)
+STImage* LoadTree(const char* _fileName)
 {
-	return Result(true, _fail);
+	size_t size = 0;
+	char* input = ReadFile(_fileName, size);
+	if(!input)
+		return 0;
+
+	if(!STImageImpl::IsValid(input, size))
+	{
+		free(input);
+		return 0;
+	}
+
+	return new STImageImpl(input, true);
 }
 
-Result Failure(const Error& _fail)
+STImage* TreeImage(const char* _first, const char* _last)
 {
-	return Result(false, _fail);
-}
+	//The arrays are read in place as words, which a block out of their alignment can't be read as, so it is copied
+	size_t size = _last - _first;
+	if(reinterpret_cast<size_t>(_first) % sizeof(unsigned int))
+	{
+		char* input = (char*)malloc(size ? size : 1);
+		if(!input)
+			return 0;
+		memcpy(input, _first, size);
 
+		if(!STImageImpl::IsValid(input, size))
+		{
+			free(input);
+			return 0;
+		}
+		return new STImageImpl(input, true);
+	}
 
+	if(!STImageImpl::IsValid(_first, size))
+		return 0;
 
+	return new STImageImpl(_first, false);
+}
 
 
 
-Parser::~Parser() {}
 
-class CharParser : public Parser
+/**
+* @brief Output buffer for emitters. Data is written to the file only when the buffer is full or flushed.
+*/
+class OutputBuffer
 {
-	Set set;
+	static const size_t SIZE = 1 << 20;
+
+	FILE*			   file;
+	char*			   buffer;
+	size_t			   used;
+	unsigned long long total;
+	bool			   ok;
+
 public:
-	CharParser(const Set& _set)
-		: set(_set)
+	OutputBuffer(FILE* _file)
+		: file(_file), buffer((char*)malloc(SIZE)), used(0), total(0), ok(buffer != 0)
 	{
 	}
-	virtual void Reset()
+	~OutputBuffer()
 	{
+		free(buffer);
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+
+	void Flush()
 	{
-		_tree = 0;
+		if(ok && used && fwrite(buffer, 1, used, file) != used)
+			ok = false;
+		used = 0;
+	}
 
-		if(_s->AtEnd())
-			return Failure(Error(set.Name(), _s->Where()));
+	void Put(char _c)
+	{
+		if(used == SIZE)
+			Flush();
+		buffer[used++] = _c;
+		total++;
+	}
 
-		char c = _s->Get();
-		if(set > c)
+	void Put(const char* _data, size_t _size)
+	{
+		if(used + _size > SIZE)
 		{
-			_tree = new STNode(_s->Where(), string(1, c));
-
-			_s->Next();
-			return Success();
+			Flush();
+			if(_size > SIZE)
+			{
+				if(ok && fwrite(_data, 1, _size, file) != _size)
+					ok = false;
+				total += _size;
+				return;
+			}
 		}
-
-		return Failure(Error(set.Name(), _s->Where()));
+		memcpy(buffer + used, _data, _size);
+		used  += _size;
+		total += _size;
 	}
-};
 
-class WordParser : public Parser
-{
-	string word;
-public:
-	WordParser(const string& _word)
-		: word(_word)
-	{
-	}
-	virtual void Reset()
+	void Put(const string& _s)
 	{
+		Put(_s.data(), _s.size());
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+
+	void Put(unsigned int _n)
 	{
-		_tree = 0;
+		char digits[10];
+		unsigned int i = 0;
+		do
+		{
+			digits[i++] = (char)('0' + _n % 10);
+			_n /= 10;
+		}
+		while(_n);
 
-		Position start = _s->Where();
+		while(i)
+			Put(digits[--i]);
+	}
 
-		if(_s->AtEnd())
-			return Failure(Error(word, start));
+	void Tabs(unsigned int _level)
+	{
+		for(unsigned int i = 0; i < _level; i++)
+			Put('\t');
+	}
 
-		for(unsigned int i = 0; i < word.size(); i++)
+	/**
+	* @brief Writes a double quoted string, escaping quotes, backslashes and control characters.
+	*/
+	void Quoted(const string& _s)
+	{
+		Put('"');
+		for(unsigned int i = 0; i < _s.size(); i++)
 		{
-			if(word[i] != _s->Get())
-			{
-				_s->Goto(start);
-				return Failure(Error(word, _s->Where()));
-			}
-			else
+			char c = _s[i];
+			switch(c)
 			{
-				_s->Next();
+			case '"':  Put("\\\"", 2); break;
+			case '\\': Put("\\\\", 2); break;
+			case '\n': Put("\\n", 2); break;
+			case '\r': Put("\\r", 2); break;
+			case '\t': Put("\\t", 2); break;
+			default:
+				if((unsigned char)c < 0x20)
+				{
+					static const char* hex = "0123456789abcdef";
+					Put("\\u00", 4);
+					Put(hex[(c >> 4) & 0xF]);
+					Put(hex[c & 0xF]);
+				}
+				else
+					Put(c);
 			}
 		}
-
-		_tree = new STNode(start, word);
-		return Success();
+		Put('"');
 	}
-};
 
-class EmptyParser : public Parser
-{
-public:
-	virtual void Reset()
+	bool Ok()
 	{
+		return ok;
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	unsigned long long Total()
 	{
-		_tree = 0;
-		return Success();
+		return total;
 	}
 };
 
-class AnyParser : public Parser
+/**
+* @brief Iterative preorder walk. _format.Open() is called when entering a node, and _format.Close() when its sons are done.
+* Formats are plain classes, so calls are resolved (and inlined) at compile time.
+*/
+template<class FORMAT> void EmitWalk(STNode* _root, FORMAT& _format)
 {
-public:
-	virtual void Reset()
-	{
-	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	struct Frame
 	{
-		_tree = 0;
-		if(_s->AtEnd())
-			return Failure(Error("ANY", _s->Where()));
+		STNode*		 node;
+		unsigned int next;
+	};
 
-		_tree = new STNode(_s->Where(), string(1, _s->Get()));
-		_s->Next();
-		return Success();
+	if(!_root)
+		return;
+
+	vector<Frame> frames;
+	Frame root = {_root, 0};
+	frames.push_back(root);
+	_format.Open(_root, 0);
+
+	while(!frames.empty())
+	{
+		Frame& top = frames.back();
+		if(top.next < top.node->childs.size())
+		{
+			Frame son = {top.node->childs[top.next], 0};
+			_format.Open(son.node, frames.size(), top.next);
+			top.next++;
+			frames.push_back(son);
+		}
+		else
+		{
+			_format.Close(top.node, frames.size() - 1);
+			frames.pop_back();
+		}
 	}
-};
+}
 
-class EndOfInputParser : public Parser
+class TextFormat
 {
+	OutputBuffer& out;
+	bool		  showPosition;
 public:
-	virtual void Reset()
+	TextFormat(OutputBuffer& _out, bool _showPosition)
+		: out(_out), showPosition(_showPosition)
 	{
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	void Open(STNode* _node, unsigned int _level, unsigned int = 0)
+	{
+		out.Tabs(_level);
+		out.Put(_node->data);
+		if(showPosition)
+		{
+			out.Put('(');
+			out.Put(_node->where.row);
+			out.Put(", ", 2);
+			out.Put(_node->where.column);
+			out.Put(')');
+		}
+		out.Put('\n');
+	}
+	void Close(STNode*, unsigned int)
 	{
-		_tree = 0;
-		return _s->AtEnd() ? 
-			Success() : 
-			Failure(Error("EOI", _s->Where()));
 	}
 };
 
-
-
-
-class CheckParser : public Parser
+class JsonFormat
 {
-	Parser* p;
-	bool present;
+	OutputBuffer& out;
+	bool		  showPosition;
 public:
-	CheckParser(Parser* _p, bool _present)
-		: p(_p), present(_present)
+	JsonFormat(OutputBuffer& _out, bool _showPosition)
+		: out(_out), showPosition(_showPosition)
 	{
 	}
-	virtual ~CheckParser()
+	void Open(STNode* _node, unsigned int, unsigned int _index = 0)
 	{
-		delete p;
+		if(_index)
+			out.Put(',');
+		out.Put("{\"data\":", 8);
+		out.Quoted(_node->data);
+		if(showPosition)
+		{
+			out.Put(",\"row\":", 7);
+			out.Put(_node->where.row);
+			out.Put(",\"column\":", 10);
+			out.Put(_node->where.column);
+		}
+		out.Put(",\"sons\":[", 9);
 	}
-	virtual void Reset()
+	void Close(STNode*, unsigned int _level)
 	{
-		p->Reset();
+		out.Put("]}", 2);
+		if(!_level)
+			out.Put('\n');
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
-	{
-		Position start = _s->Where();
-	
-		Result r = p->Parse(_s, _tree);
+};
+
+class SExpressionFormat
+{
+	OutputBuffer& out;
+	bool		  showPosition;
+
+	bool IsList(STNode* _node)
+	{
+		return showPosition || !_node->childs.empty();
+	}
+public:
+	SExpressionFormat(OutputBuffer& _out, bool _showPosition)
+		: out(_out), showPosition(_showPosition)
+	{
+	}
+	void Open(STNode* _node, unsigned int _level, unsigned int = 0)
+	{
+		if(_level)
+			out.Put(' ');
+		if(IsList(_node))
+			out.Put('(');
+		out.Quoted(_node->data);
+		if(showPosition)
+		{
+			out.Put(' ');
+			out.Put(_node->where.row);
+			out.Put(' ');
+			out.Put(_node->where.column);
+		}
+	}
+	void Close(STNode* _node, unsigned int _level)
+	{
+		if(IsList(_node))
+			out.Put(')');
+		if(!_level)
+			out.Put('\n');
+	}
+};
+
+TreeEmitter::~TreeEmitter() {}
+
+template<class FORMAT> class FormatEmitter : public TreeEmitter
+{
+	bool			   showPosition;
+	unsigned long long bytes;
+public:
+	FormatEmitter(bool _showPosition)
+		: showPosition(_showPosition), bytes(0)
+	{
+	}
+	virtual bool Emit(STNode* _tree, FILE* _file)
+	{
+		OutputBuffer out(_file);
+		FORMAT format(out, showPosition);
+		EmitWalk(_tree, format);
+		out.Flush();
+
+		bytes = out.Total();
+		return out.Ok();
+	}
+	virtual unsigned long long Bytes()
+	{
+		return bytes;
+	}
+};
+
+class BinaryEmitterImpl : public TreeEmitter
+{
+	unsigned long long bytes;
+public:
+	BinaryEmitterImpl()
+		: bytes(0)
+	{
+	}
+	virtual bool Emit(STNode* _tree, FILE* _file)
+	{
+		ImageWriter w(_tree);
+		bool written = w.Write(_file);
+		bytes = w.Bytes();
+		return written;
+	}
+	virtual unsigned long long Bytes()
+	{
+		return bytes;
+	}
+};
+
+TreeEmitter* TextEmitter		(bool _showPosition){return new FormatEmitter<TextFormat>(_showPosition);}
+TreeEmitter* JsonEmitter		(bool _showPosition){return new FormatEmitter<JsonFormat>(_showPosition);}
+TreeEmitter* SExpressionEmitter	(bool _showPosition){return new FormatEmitter<SExpressionFormat>(_showPosition);}
+TreeEmitter* BinaryEmitter		()					{return new BinaryEmitterImpl();}
+
+
+
+
+TreeIndex::~TreeIndex() {}
+
+/**
+* @brief TreeIndex Implementation.
+* Nodes are numbered in preorder, so the subtree of a node is the range [node, last[node]] and
+* nodes with the same data, kept sorted by number, are searched by range with a binary search.
+* Extents are painted in preorder (sons over its parent) into a map of disjoint segments,
+* which is then flattened into sorted arrays for binary search.
+*/
+class TreeIndexImpl : public TreeIndex
+{
+	vector<STNode*>						   nodes;   //!< Nodes, in preorder.
+	vector<unsigned int>				   last;    //!< Last node of the subtree of each node.
+	vector<unsigned int>				   parents; //!< Parent of each node (itself for the root).
+	unordered_map<STNode*, unsigned int>   numbers;
+	unordered_map<string, vector<unsigned int> > datas;
+
+	vector<Position>					   segmentStarts;
+	vector<int>							   segmentNodes; //!< Innermost node of each segment, -1 if none.
+
+	static const size_t					   BLOCK = 64;
+	size_t								   size;		   //!< Of the text, if built with it.
+	vector<size_t>						   segmentOffsets; //!< Offset of the start of each segment, if built with the text.
+	vector<unsigned int>				   blocks;		   //!< Segment covering the first char of each block of BLOCK chars.
+
+	static int Covering(map<Position, int>& _segments, const Position& _where)
+	{
+		map<Position, int>::iterator i = _segments.upper_bound(_where);
+		if(i == _segments.begin())
+			return -1;
+		--i;
+		return i->second;
+	}
+
+	static void Paint(map<Position, int>& _segments, const Position& _start, const Position& _end, int _node)
+	{
+		if(!(_start < _end))
+			return;
+
+		int after = Covering(_segments, _end);
+		_segments.erase(_segments.lower_bound(_start), _segments.lower_bound(_end));
+		_segments[_start] = _node;
+		if(_segments.find(_end) == _segments.end())
+			_segments[_end] = after;
+	}
+
+	void Number(STNode* _root)
+	{
+		struct Frame
+		{
+			STNode*		 node;
+			unsigned int number;
+			unsigned int next;
+		};
+
+		vector<Frame> frames;
+		Frame root = {_root, 0, 0};
+		frames.push_back(root);
+		nodes.push_back(_root);
+		parents.push_back(0);
+		last.push_back(0);
+
+		while(!frames.empty())
+		{
+			Frame& top = frames.back();
+			if(top.next < top.node->childs.size())
+			{
+				Frame son = {top.node->childs[top.next], static_cast<unsigned int>(nodes.size()), 0};
+				top.next++;
+				nodes.push_back(son.node);
+				parents.push_back(top.number);
+				last.push_back(son.number);
+				frames.push_back(son);
+			}
+			else
+			{
+				last[top.number] = nodes.size() - 1;
+				frames.pop_back();
+			}
+		}
+	}
+
+	void Build(STNode* _root, const Position& _end)
+	{
+		Number(_root);
+
+		for(unsigned int i = 0; i < nodes.size(); i++)
+		{
+			numbers.insert(pair<STNode*, unsigned int>(nodes[i], i));
+			datas[nodes[i]->data].push_back(i);
+		}
+
+		//Starts, sons before parents
+		vector<Position> starts(nodes.size());
+		for(unsigned int i = nodes.size(); i-- > 0; )
+		{
+			starts[i] = nodes[i]->where;
+			for(unsigned int j = 0; j < nodes[i]->childs.size(); j++)
+			{
+				unsigned int son = numbers[nodes[i]->childs[j]];
+				if(starts[son] < starts[i])
+					starts[i] = starts[son];
+			}
+		}
+
+		//Ends, parents before sons: a son ends where the next one starts, and the last one where its parent ends
+		vector<Position> ends(nodes.size());
+		ends[0] = _end;
+		for(unsigned int i = 0; i < nodes.size(); i++)
+		{
+			for(unsigned int j = 0; j < nodes[i]->childs.size(); j++)
+			{
+				unsigned int son = numbers[nodes[i]->childs[j]];
+				ends[son] = ends[i];
+				if(j + 1 < nodes[i]->childs.size())
+				{
+					Position next = starts[numbers[nodes[i]->childs[j + 1]]];
+					if(next < ends[son])
+						ends[son] = next;
+				}
+			}
+		}
+
+		//Innermost nodes, parents before sons
+		map<Position, int> segments;
+		for(unsigned int i = 0; i < nodes.size(); i++)
+			Paint(segments, starts[i], ends[i], i);
+
+		for(map<Position, int>::iterator i = segments.begin(); i != segments.end(); i++)
+		{
+			segmentStarts.push_back(i->first);
+			segmentNodes.push_back(i->second);
+		}
+	}
+
+	/**
+	* @brief Finds the offsets of the segments in a text with those lines, and the segment each block of the text starts in.
+	*/
+	void Locate(const vector<size_t>& _lines, size_t _size)
+	{
+		size = _size;
+		for(unsigned int i = 0; i < segmentStarts.size(); i++)
+		{
+			const Position& start = segmentStarts[i];
+			size_t offset = size;
+			if(start.row >= 1 && start.row <= _lines.size())
+				offset = min(_lines[start.row - 1] + max(start.column, 1u) - 1, size);
+			segmentOffsets.push_back(i ? max(offset, segmentOffsets.back()) : offset);
+		}
+
+		blocks.resize(size / BLOCK + 1);
+		unsigned int segment = 0;
+		for(size_t i = 0; i < blocks.size(); i++)
+		{
+			while(segment + 1 < segmentOffsets.size() && segmentOffsets[segment + 1] <= i * BLOCK)
+				segment++;
+			blocks[i] = segment;
+		}
+	}
+
+public:
+	TreeIndexImpl(STNode* _root, const Position& _end)
+		: size(0)
+	{
+		if(_root)
+			Build(_root, _end);
+	}
+	TreeIndexImpl(STNode* _root, const char* _first, const char* _last)
+		: size(0)
+	{
+		if(!_root)
+			return;
+
+		vector<size_t> lines(1, 0);
+		for(const char* end = _first; (end = static_cast<const char*>(memchr(end, '\n', _last - end))) != 0; end++)
+			lines.push_back(end + 1 - _first);
+
+		Build(_root, Position(static_cast<unsigned int>(lines.size()), static_cast<unsigned int>(_last - _first - lines.back()) + 1));
+		Locate(lines, _last - _first);
+	}
+
+	virtual vector<STNode*> Nodes(const string& _data)
+	{
+		vector<STNode*> result;
+
+		unordered_map<string, vector<unsigned int> >::iterator i = datas.find(_data);
+		if(i == datas.end())
+			return result;
+
+		for(unsigned int j = 0; j < i->second.size(); j++)
+			result.push_back(nodes[i->second[j]]);
+		return result;
+	}
+
+	virtual vector<STNode*> Descendants(STNode* _node, const string& _data)
+	{
+		vector<STNode*> result;
+
+		unordered_map<STNode*, unsigned int>::iterator n = numbers.find(_node);
+		unordered_map<string, vector<unsigned int> >::iterator i = datas.find(_data);
+		if(n == numbers.end() || i == datas.end())
+			return result;
+
+		vector<unsigned int>::iterator first = upper_bound(i->second.begin(), i->second.end(), n->second);
+		vector<unsigned int>::iterator end   = upper_bound(first, i->second.end(), last[n->second]);
+		for(; first != end; first++)
+			result.push_back(nodes[*first]);
+		return result;
+	}
+
+	virtual STNode* At(const Position& _where)
+	{
+		vector<Position>::iterator i = upper_bound(segmentStarts.begin(), segmentStarts.end(), _where);
+		if(i == segmentStarts.begin())
+			return 0;
+
+		int node = segmentNodes[(i - segmentStarts.begin()) - 1];
+		return (node < 0) ? 0 : nodes[node];
+	}
+
+	virtual STNode* AtOffset(size_t _offset)
+	{
+		if(_offset >= size || segmentOffsets.empty() || _offset < segmentOffsets[0])
+			return 0;
+
+		//Segments are at least a char long, so there are few of them in a block
+		unsigned int segment = blocks[_offset / BLOCK];
+		while(segment + 1 < segmentOffsets.size() && segmentOffsets[segment + 1] <= _offset)
+			segment++;
+
+		int node = segmentNodes[segment];
+		return (node < 0) ? 0 : nodes[node];
+	}
+
+	virtual STNode* Parent(STNode* _node)
+	{
+		unordered_map<STNode*, unsigned int>::iterator n = numbers.find(_node);
+		if(n == numbers.end() || n->second == 0)
+			return 0;
+
+		return nodes[parents[n->second]];
+	}
+
+	virtual vector<STNode*> Ancestors(STNode* _node)
+	{
+		vector<STNode*> result;
+		for(STNode* p = Parent(_node); p; p = Parent(p))
+			result.push_back(p);
+		return result;
+	}
+};
+
+TreeIndex* IndexTree(STNode* _root, const Position& _end)
+{
+	return new TreeIndexImpl(_root, _end);
+}
+
+TreeIndex* IndexTree(STNode* _root, const char* _first, const char* _last)
+{
+	return new TreeIndexImpl(_root, _first, _last);
+}
+
+
+
+
+
+
+
+bool Set::contains(const vector<char>& _set, const char& _element) const
+{
+	return find(_set.begin(), _set.end(), _element) != _set.end();
+}
+
+Set::Set(){}
+
+Set::Set(char _c)
+{
+	elements.push_back(_c);
+}
+
+Set Set::operator+(const Set& _set) const
+{
+	//Union starts with one set
+	Set union_set(*this);
+
+	for (size_t i = 0; i < _set.elements.size(); i++)
+	{
+		if(!contains(elements, _set.elements[i]))
+		{
+			//Element NOT FOUND, so add to union
+			union_set.elements.push_back(_set.elements[i]);
+		}
+	}
+
+	return union_set;
+}
+
+Set Set::operator*(const Set& _set) const
+{
+	//Intersection starts empty
+	Set intersection_set;
+
+	for (size_t i = 0; i < _set.elements.size(); i++)
+	{
+		if(contains(elements, _set.elements[i]))
+		{
+			//Element FOUND, so add to intersection
+			intersection_set.elements.push_back(_set.elements[i]);
+		}
+	}
+
+	return intersection_set;
+}
+
+Set Set::operator-(const Set& _set) const
+{
+	//Intersection starts empty
+	Set difference_set;
+
+	for (size_t i = 0; i < elements.size(); i++)
+	{
+		if(!contains(_set.elements, elements[i]))
+		{
+			//Element NOT FOUND, so add to difference
+			difference_set.elements.push_back(_set.elements[i]);
+		}
+	}
+
+	return difference_set;
+}
+
+bool Set::operator<(const Set& _set) const
+{
+	//Test this contained in _set
+	for (size_t i = 0; i < elements.size(); i++)
+	{
+		if(!contains(_set.elements, elements[i]))
+			return false;
+	}
+	return true;
+}
+
+bool Set::operator>(const Set& _set) const
+{
+	//Test _set contained in this
+	for (size_t i = 0; i < _set.elements.size(); i++)
+	{
+		if(!contains(elements, _set.elements[i]))
+			return false;
+	}
+	return true;
+}
+
+bool Set::operator==(const Set& _set) const
+{
+	//Equal is _set contained in *this, and *this contained in _set
+	return (_set < *this) && (*this < _set);
+}
+
+bool Set::operator!=(const Set& _set) const
+{
+	return ! operator==(_set);
+}
+
+string Set::Name()
+{
+	string result = "[";
+	for(unsigned int i = 0; i < elements.size(); i++)
+		result += elements[i];
+	result += "]";
+	return result;
+}
+
+Set Range(char _begin, char _end)
+{
+	Set result;
+	for (char i = _begin; i <= _end; i++)
+		result = result + i;
+	return result;
+}
+
+Set Enumeration(unsigned int _number, ...)
+{
+	va_list arguments;                     
+	Set result;
+
+	va_start(arguments, _number);           
+	for(unsigned int i = 0; i < _number; i++)
+	{
+		result = result + va_arg(arguments, char); 
+	}
+	va_end(arguments);
+		
+	return result;
+}
+
+
+
+
+
+Error::Error(const string& _expected, const Position& _where)
+	: where(_where)
+{
+	if(!_expected.empty())
+		expected.push_back(_expected);
+}
+
+Error& Error::operator+=(const Error& _error)
+{
+	//Replace
+	if(_error.where > where)
+	{
+		*this = _error;
+	}
+	
+	//Add
+	if(_error.where == where)
+	{
+		for(unsigned int i = 0; i < _error.expected.size(); i++)
+		{
+			if(find(expected.begin(), expected.end(), _error.expected[i]) == expected.end()) 
+				expected.push_back(_error.expected[i]);
+		}
+	}
+
+	return *this;
+}
+
+Error::operator bool()
+{
+	return where != Position() || !expected.empty();
+}
+
+
+
+Result::Result(bool _match, ErrorHandle _error)
+	: match(_match), aborted(false), error(_error)
+{}
+
+Result::operator bool()
+{
+	return match;
+}
+
+Result Result::operator!()
+{
+	return Result(!match, error);
+}
+
+Result Result::Clear()
+{
+	error = 0;
+	return *this;
+}
+
+Result Success(ErrorHandle _error)
+{
+	return Result(true, _error);
+}
+
+Result Failure(ErrorHandle _error)
+{
+	return Result(false, _error);
+}
+
+Result Aborted()
+{
+	Result r(false);
+	r.aborted = true;
+	return r;
+}
+
+Limits::Limits(unsigned long long _steps, unsigned int _milliseconds, const atomic<bool>* _cancel)
+	: steps(_steps), milliseconds(_milliseconds), cancel(_cancel)
+{
+}
+
+
+
+/**
+* @brief Registry of expectations, shared by every parser of the process.
+*/
+class ExpectationRegistry
+{
+	mutex						lock;
+	vector<string>				descriptions;
+	map<string, Expectation>	expectations;
+public:
+	Expectation Expect(const string& _description)
+	{
+		lock_guard<mutex> guard(lock);
+
+		map<string, Expectation>::iterator i = expectations.find(_description);
+		if(i != expectations.end())
+			return i->second;
+
+		Expectation expectation = static_cast<Expectation>(descriptions.size());
+		descriptions.push_back(_description);
+		expectations.insert(pair<string, Expectation>(_description, expectation));
+		return expectation;
+	}
+	string Description(Expectation _expectation)
+	{
+		lock_guard<mutex> guard(lock);
+
+		return _expectation < descriptions.size() ? descriptions[_expectation] : string();
+	}
+};
+
+static ExpectationRegistry& Registry()
+{
+	static ExpectationRegistry registry;
+	return registry;
+}
+
+Expectation Expect(const string& _description)
+{
+	return Registry().Expect(_description);
+}
+
+string Description(Expectation _expectation)
+{
+	return Registry().Description(_expectation);
+}
+
+
+
+ParseContext::ParseContext(Stream* _s, bool _diagnose, bool _recover)
+	: input(_s), diagnose(_diagnose), recover(_recover), first(0), kept(0), 
+	  limited(false), aborted(false), steps(0), budget(0), timed(false), cancel(0), outer(0), tokens(0), tracked(0)
+{
+}
+
+
+Stream* ParseContext::Input()
+{
+	return input;
+}
+
+bool ParseContext::Diagnoses()
+{
+	return diagnose;
+}
+
+bool ParseContext::Recovers()
+{
+	return recover;
+}
+
+ErrorHandle ParseContext::Fail(Expectation _expected, const Position& _where)
+{
+	if(!diagnose)
+		return 0;
+
+	if(first == expectations.size() || _where > farthest)
+	{
+		farthest = _where;
+		expectations.resize(kept);
+		first = kept;
+	}
+	else if(_where < farthest || find(expectations.begin() + first, expectations.end(), _expected) != expectations.end())
+	{
+		return 1;
+	}
+
+	expectations.push_back(_expected);
+	return 1;
+}
+
+ErrorHandle ParseContext::Merge(ErrorHandle _a, ErrorHandle _b)
+{
+	return _a ? _a : _b;
+}
+
+Error ParseContext::Report(ErrorHandle _error)
+{
+	if(!_error || first == expectations.size())
+		return Error();
+
+	Error error("", farthest);
+	for(unsigned int i = first; i < expectations.size(); i++)
+		error.expected.push_back(Description(expectations[i]));
+	return error;
+}
+
+ParseContext::ErrorMark ParseContext::Mark()
+{
+	ErrorMark mark;
+	mark.farthest = farthest;
+	mark.first	  = first;
+	mark.size	  = static_cast<unsigned int>(expectations.size());
+	mark.kept	  = kept;
+
+	kept  = mark.size;
+	first = mark.size;
+	return mark;
+}
+
+void ParseContext::Keep(const ErrorMark& _mark)
+{
+	kept = _mark.kept;
+	if(_mark.first == _mark.size)
+		return;
+
+	//Keep the furthest of the record at the mark and the one since, or merge them if at the same position
+	if(first == expectations.size() || farthest < _mark.farthest)
+	{
+		Drop(_mark);
+		return;
+	}
+	if(farthest > _mark.farthest)
+		return;
+
+	unsigned int added = 0;
+	for(unsigned int i = first; i < expectations.size(); i++)
+	{
+		if(find(expectations.begin() + _mark.first, expectations.begin() + _mark.size, expectations[i]) == expectations.begin() + _mark.size)
+			expectations[_mark.size + added++] = expectations[i];
+	}
+	expectations.resize(_mark.size + added);
+	first = _mark.first;
+}
+
+void ParseContext::Drop(const ErrorMark& _mark)
+{
+	expectations.resize(_mark.size);
+	farthest = _mark.farthest;
+	first	 = _mark.first;
+	kept	 = _mark.kept;
+}
+
+void ParseContext::Recorded(Position& _where, vector<Expectation>& _expected)
+{
+	_where = farthest;
+	_expected.assign(expectations.begin() + first, expectations.end());
+}
+
+void ParseContext::Replay(const Position& _where, const vector<Expectation>& _expected)
+{
+	for(unsigned int i = 0; i < _expected.size(); i++)
+		Fail(_expected[i], _where);
+}
+
+void ParseContext::Budget(unsigned long long _steps)
+{
+	budget = _steps;
+	limited = limited || (budget != 0);
+}
+
+void ParseContext::Timeout(unsigned int _milliseconds)
+{
+	deadline = chrono::steady_clock::now() + chrono::milliseconds(_milliseconds);
+	timed = true;
+	limited = true;
+}
+
+void ParseContext::Cancellation(const atomic<bool>* _cancel)
+{
+	cancel = _cancel;
+	limited = limited || (cancel != 0) || (outer != 0);
+}
+
+void ParseContext::Limit(const Limits& _limits)
+{
+	limited = false;
+	timed	= false;
+	outer	= 0;
+
+	Budget(_limits.steps);
+	if(_limits.milliseconds)
+		Timeout(_limits.milliseconds);
+	Cancellation(_limits.cancel);
+}
+
+void ParseContext::Inherit(const ParseContext& _outer)
+{
+	budget	 = _outer.budget;
+	if(budget)
+		budget = (_outer.steps < budget) ? budget - _outer.steps : 1;
+	timed	 = _outer.timed;
+	deadline = _outer.deadline;
+	cancel	 = 0;
+	outer	 = &_outer;
+	limited	 = budget || timed || _outer.limited;
+}
+
+bool ParseContext::Cancelled() const
+{
+	return (cancel && cancel->load(memory_order_relaxed)) || (outer && outer->Cancelled());
+}
+
+bool ParseContext::Exceeded()
+{
+	steps++;
+
+	if(budget && steps > budget)
+		return true;
+
+	if(Cancelled())
+		return true;
+
+	//Reading the clock is far more expensive than a step
+	if(timed && !(steps & 0x3FF) && chrono::steady_clock::now() > deadline)
+		return true;
+
+	return false;
+}
+
+bool ParseContext::Abort()
+{
+	if(!limited)
+		return false;
+
+	if(!aborted)
+		aborted = Exceeded();
+
+	return aborted;
+}
+
+bool ParseContext::Stopped()
+{
+	return aborted;
+}
+
+unsigned long long ParseContext::Steps()
+{
+	return steps;
+}
+
+void ParseContext::Recovered(const Position& _node, const Error& _error)
+{
+	recovered[_node] = _error;
+}
+
+void ParseContext::Report(STNode* _tree, vector<Error>& _errors)
+{
+	class ErrorCollector : public TreeVisitor
+	{
+		ParseContext* c;
+		vector<Error>& errors;
+	public:
+		ErrorCollector(ParseContext* _c, vector<Error>& _errors)
+			: c(_c), errors(_errors)
+		{
+		}
+		bool Visit(STNode* _node, unsigned int)
+		{
+			if(_node->data == ERROR_NODE)
+			{
+				map<Position, Error>::iterator i = c->recovered.find(_node->where);
+				if(i != c->recovered.end())
+					errors.push_back(i->second);
+			}
+			return true;
+		}
+	};
+
+	ErrorCollector collector(this, _errors);
+	PreWalk(_tree, &collector);
+}
+
+
+
+
+
+
+Firsts::Firsts()
+	: nullable(false)
+{
+	memset(chars, 0, sizeof(chars));
+}
+
+void Firsts::Add(char _c)
+{
+	chars[static_cast<unsigned char>(_c)] = true;
+}
+
+void Firsts::AddChars(const Firsts& _firsts)
+{
+	for(unsigned int i = 0; i < 256; i++)
+		chars[i] = chars[i] || _firsts.chars[i];
+}
+
+void Firsts::Anything()
+{
+	memset(chars, 1, sizeof(chars));
+	nullable = true;
+}
+
+Parser::~Parser() {}
+
+void Parser::First(Firsts& _firsts, FirstsAnalysis&)
+{
+	_firsts.Anything();
+}
+
+Parser* Parser::Optimized(Optimizer&)
+{
+	return this;
+}
+
+string Parser::Signature(Optimizer&)
+{
+	return "";
+}
+
+/**
+* @brief Stands for a parser alike another one, which is used instead. @see Optimizer
+* It keeps the parser it stands for, so that whatever that owned is deleted along with it, as before.
+*/
+class AliasParser : public Parser
+{
+	Parser* p;
+	Parser* alike;
+public:
+	AliasParser(Parser* _p, Parser* _alike)
+		: p(_p), alike(_alike)
+	{
+	}
+	virtual ~AliasParser()
+	{
+		delete alike;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		return p->Parse(_c, _tree);
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	Parser* Target()
+	{
+		return p;
+	}
+};
+
+static bool Basic(Parser* _p);
+
+/**
+* @brief Pass of Optimize over the graph of a grammar, in three phases. It first counts the parsers using each one, so that those
+* shared by several are never replaced nor taken apart, and finds the rules each one refers to, so that those off any cycle are known.
+* Then it rewrites every parser once; replaced parsers are deleted at the end, so that no new parser takes the address of one already
+* optimized. A reference to a rule off any cycle is replaced by the parser of the rule: the first one takes it, the others and the
+* variable of the rule get aliases of it. Last, it shares parsers alike: going bottom up, a parser with the same signature as one
+* found before is replaced by an alias of that one, so that both use the same memorization.
+*/
+class Optimizer
+{
+	enum Phase
+	{
+		COUNTING,
+		REWRITING,
+		SHARING
+	};
+
+	Phase						phase;
+	map<Parser*, unsigned int>	users;
+	map<Parser*, Parser*>		optimized;
+	vector<Parser*>				replaced;
+
+	vector<Parser**>				   rules;
+	vector<Parser*>					   counting;	//!< Parsers being counted, innermost last
+	map<Parser*, set<Parser**>>		   reached;		//!< Rules referred to by each parser counted, or by those inside it
+	map<Parser**, Parser*>			   roots;		//!< Parser of each rule off any cycle, before rewriting
+	map<Parser**, Parser*>			   inlined;		//!< Parser taken by a reference, for each rule inlined
+
+	map<string, Parser*>		signatures;
+	map<const void*, unsigned int> ids;
+	map<Parser*, Parser*>		twins;
+public:
+	Optimizer(const vector<Parser**>& _rules)
+		: phase(COUNTING), rules(_rules)
+	{
+	}
+	~Optimizer()
+	{
+		for(unsigned int i = 0; i < replaced.size(); i++)
+			delete replaced[i];
+	}
+	Parser* Optimize(Parser* _p)
+	{
+		if(!_p)
+			return _p;
+
+		if(phase == COUNTING)
+		{
+			if(!users[_p]++)
+			{
+				counting.push_back(_p);
+				_p->Optimized(*this);
+				counting.pop_back();
+			}
+
+			if(!counting.empty())
+			{
+				set<Parser**>& inside = reached[_p];
+				reached[counting.back()].insert(inside.begin(), inside.end());
+			}
+			return _p;
+		}
+
+		map<Parser*, Parser*>::iterator done = optimized.find(_p);
+		if(done != optimized.end())
+		{
+			//Every other user of a parser replaced by an alias gets an alias of its own
+			if(phase == SHARING && done->second != _p)
+				return new AliasParser(done->second, 0);
+			return done->second;
+		}
+
+		optimized[_p] = _p;
+		Parser* q = _p->Optimized(*this);
+		if(phase == REWRITING)
+		{
+			optimized[_p] = q;
+			return q;
+		}
+
+		string signature = _p->Signature(*this);
+		if(signature.empty())
+			return _p;
+
+		map<string, Parser*>::iterator alike = signatures.find(signature);
+		if(alike == signatures.end())
+		{
+			signatures[signature] = _p;
+			return _p;
+		}
+
+		//Basic parsers memorize nothing, so sharing them would only add a call; they are told alike by their twin
+		if(Basic(_p))
+		{
+			twins[_p] = alike->second;
+			return _p;
+		}
+
+		optimized[_p] = alike->second;
+		return new AliasParser(alike->second, _p);
+	}
+	/**
+	* @brief Ends a phase, going to the next one.
+	*/
+	void Next()
+	{
+		if(phase == COUNTING)
+		{
+			for(unsigned int i = 0; i < rules.size(); i++)
+			{
+				if(!Recursive(rules[i]))
+					roots[rules[i]] = *rules[i];
+			}
+			reached.clear();
+			phase = REWRITING;
+		}
+		else
+		{
+			//The parser of an inlined rule is owned by the reference which took it
+			for(map<Parser**, Parser*>::iterator rule = inlined.begin(); rule != inlined.end(); ++rule)
+				*rule->first = new AliasParser(rule->second, 0);
+			phase = SHARING;
+		}
+		optimized.clear();
+	}
+	/**
+	* @brief Whether parsers may be rewritten now. Otherwise their parsers must be given to Optimize, but they must not change.
+	*/
+	bool Rewrites() const
+	{
+		return phase == REWRITING;
+	}
+	/**
+	* @brief Whether _p is used by several parsers, so it must not be replaced nor taken apart.
+	*/
+	bool Shared(Parser* _p)
+	{
+		return users[_p] > 1;
+	}
+	/**
+	* @brief Tells that the parser being counted refers to _rule.
+	*/
+	void Refers(Parser** _rule)
+	{
+		if(phase == COUNTING)
+			reached[counting.back()].insert(_rule);
+	}
+	/**
+	* @brief Optimized parser of _rule, for a reference to take its place, if the rule is off any cycle. Otherwise 0.
+	* The first reference gets the parser itself, and every other one an alias of it.
+	*/
+	Parser* Inlined(Parser** _rule)
+	{
+		map<Parser**, Parser*>::iterator root = roots.find(_rule);
+		if(root == roots.end())
+			return 0;
+
+		Parser* q = Optimize(root->second);
+		users[q]++;
+		if(inlined.count(_rule))
+			return new AliasParser(q, 0);
+
+		inlined[_rule] = q;
+		return q;
+	}
+	/**
+	* @brief Deletes _p at the end, once what it owned has been taken from it.
+	*/
+	void Replaced(Parser* _p)
+	{
+		replaced.push_back(_p);
+	}
+	/**
+	* @brief Short text identifying a parser, already shared, or anything else, as the variable of a Reference, in signatures.
+	*/
+	string Id(const void* _p)
+	{
+		map<const void*, unsigned int>::iterator found = ids.find(_p);
+		if(found == ids.end())
+			found = ids.insert(make_pair(_p, static_cast<unsigned int>(ids.size()))).first;
+		return to_string(found->second);
+	}
+	string Id(Parser* _p)
+	{
+		AliasParser* alias = dynamic_cast<AliasParser*>(_p);
+		if(alias)
+			_p = alias->Target();
+
+		map<Parser*, Parser*>::iterator twin = twins.find(_p);
+		return Id(static_cast<const void*>(twin != twins.end() ? twin->second : _p));
+	}private:
+	/**
+	* @brief Whether _rule is on a cycle of references. Rules not given to Optimize are not followed, as they are never optimized.
+	*/
+	bool Recursive(Parser** _rule)
+	{
+		set<Parser**> visited;
+		vector<Parser**> pending(1, _rule);
+		while(!pending.empty())
+		{
+			map<Parser*, set<Parser**>>::iterator found = reached.find(*pending.back());
+			pending.pop_back();
+			if(found == reached.end())
+				continue;
+
+			set<Parser**>& next = found->second;
+			for(set<Parser**>::iterator i = next.begin(); i != next.end(); ++i)
+			{
+				if(*i == _rule)
+					return true;
+				if(visited.insert(*i).second)
+					pending.push_back(*i);
+			}
+		}
+		return false;
+	}
+};
+
+/**
+* @brief Signature of a text, which can't be taken for a part of another one.
+*/
+static string Quoted(const string& _text)
+{
+	return to_string(_text.size()) + ":" + _text;
+}
+
+Result Parser::Parse(Stream* _s, STNode*& _tree, const Limits& _limits)
+{
+	ParseContext c(_s, false);
+	c.Limit(_limits);
+
+	return Parse(c, _tree);
+}
+
+/**
+* @brief Parses the input of _c first without recording errors, and only if that fails, again recording them to report the error.
+*/
+static Result ParseInTwoPhases(Parser* _p, ParseContext& _c, STNode*& _tree, Error& _error)
+{
+	Stream* s = _c.Input();
+	Position start = s->Where();
+
+	//Fast path
+	_c.Restart(s, false);
+
+	Result r = _p->Parse(_c, _tree);
+	if(r || r.aborted)
+		return r;
+
+	//Diagnostic path
+	s->Goto(start);
+	_c.Restart(s);
+
+	r = _p->Parse(_c, _tree);
+	if(!r)
+		_error = _c.Report(r.error);
+	return r;
+}
+
+Result Parser::Parse(Stream* _s, STNode*& _tree, Error& _error, const Limits& _limits)
+{
+	ParseContext c(_s);
+	c.Limit(_limits);
+
+	return ParseInTwoPhases(this, c, _tree, _error);
+}
+
+Result Parser::Parse(Stream* _s, STNode*& _tree, vector<Error>& _errors, const Limits& _limits)
+{
+	Position start = _s->Where();
+
+	//Fast path
+	ParseContext c(_s, false);
+	c.Limit(_limits);
+
+	Result r = Parse(c, _tree);
+	if(r || r.aborted)
+		return r;
+
+	//Recovery path
+	_s->Goto(start);
+	c.Restart(_s, true, true);
+
+	r = Parse(c, _tree);
+	c.Report(_tree, _errors);
+	if(!r)
+		_errors.push_back(c.Report(r.error));
+	return r;
+}
+
+class CharParser : public Parser
+{
+	bool				chars[256]; //!< Whether each char, by its unsigned value, is in the set
+	vector<Expectation>	expected;	//!< Of each set fused in this one, in order
+
+	ErrorHandle Fail(ParseContext& _c, const Position& _where)
+	{
+		ErrorHandle e = 0;
+		for(unsigned int i = 0; i < expected.size(); i++)
+			e = _c.Merge(e, _c.Fail(expected[i], _where));
+		return e;
+	}
+public:
+	CharParser(const Set& _set)
+	{
+		Set set(_set);
+		for(unsigned int i = 0; i < 256; i++)
+			chars[i] = set > static_cast<char>(i);
+		expected.push_back(Expect(set.Name()));
+	}
+	/**
+	* @brief Fuses alternatives of single chars, behaving as a Choice of both.
+	*/
+	CharParser(const CharParser& _first, const CharParser& _second)
+		: expected(_first.expected)
+	{
+		for(unsigned int i = 0; i < 256; i++)
+			chars[i] = _first.chars[i] || _second.chars[i];
+		expected.insert(expected.end(), _second.expected.begin(), _second.expected.end());
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		_tree = 0;
+
+		if(_s->AtEnd())
+			return Failure(Fail(_c, _s->Where()));
+
+		char c = _s->Get();
+		if(chars[static_cast<unsigned char>(c)])
+		{
+			_tree = new STNode(_s->Where(), string(1, c));
+
+			_s->Next();
+			return Success();
+		}
+
+		return Failure(Fail(_c, _s->Where()));
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis&)
+	{
+		for(unsigned int i = 0; i < 256; i++)
+		{
+			if(chars[i])
+				_firsts.Add(static_cast<char>(i));
+		}
+	}
+	virtual string Signature(Optimizer&)
+	{
+		string signature = "Char(";
+		for(unsigned int i = 0; i < 256; i++)
+			signature += chars[i] ? '1' : '0';
+		for(unsigned int i = 0; i < expected.size(); i++)
+			signature += "," + to_string(expected[i]);
+		return signature + ")";
+	}
+};
+
+class WordParser : public Parser
+{
+	string word;
+	Expectation expected;
+public:
+	WordParser(const string& _word)
+		: word(_word), expected(Expect(_word))
+	{
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		_tree = 0;
+
+		Position start = _s->Where();
+
+		if(_s->AtEnd())
+			return Failure(_c.Fail(expected, start));
+
+		//Compared at once, if the stream has it in memory
+		const char* next = _s->Peek(static_cast<unsigned int>(word.size()));
+		if(next)
+		{
+			if(memcmp(next, word.data(), word.size()) != 0)
+				return Failure(_c.Fail(expected, start));
+
+			for(unsigned int i = 0; i < word.size(); i++)
+				_s->Next();
+
+			_tree = new STNode(start, word);
+			return Success();
+		}
+
+		for(unsigned int i = 0; i < word.size(); i++)
+		{
+			if(word[i] != _s->Get())
+			{
+				_s->Goto(start);
+				return Failure(_c.Fail(expected, _s->Where()));
+			}
+			else
+			{
+				_s->Next();
+			}
+		}
+
+		_tree = new STNode(start, word);
+		return Success();
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis&)
+	{
+		if(word.empty())
+			_firsts.nullable = true;
+		else
+			_firsts.Add(word[0]);
+	}
+	virtual string Signature(Optimizer&)
+	{
+		return "Word(" + Quoted(word) + ")";
+	}
+};
+
+class KeywordsParser : public Parser
+{
+	struct Node
+	{
+		vector<pair<char, unsigned int> > next; //!< Sorted by char
+		int								  word; //!< First word, in order, ending here, or -1
+	};
+
+	vector<string>		words;
+	vector<Expectation>	expected;
+	vector<Node>		trie;
+	unsigned int		longest;
+
+	int Find(unsigned int _node, char _c) const
+	{
+		const vector<pair<char, unsigned int> >& next = trie[_node].next;
+		vector<pair<char, unsigned int> >::const_iterator i = lower_bound(next.begin(), next.end(), make_pair(_c, 0u));
+		return (i != next.end() && i->first == _c) ? static_cast<int>(i->second) : -1;
+	}
+	void Found(unsigned int _node, int& _word) const
+	{
+		int word = trie[_node].word;
+		if(word >= 0 && (_word < 0 || word < _word))
+			_word = word;
+	}
+public:
+	KeywordsParser(const vector<string>& _words)
+		: words(_words), trie(1), longest(0)
+	{
+		trie[0].word = -1;
+		for(unsigned int w = 0; w < words.size(); w++)
+		{
+			expected.push_back(Expect(words[w]));
+			longest = max(longest, static_cast<unsigned int>(words[w].size()));
+
+			unsigned int node = 0;
+			for(unsigned int i = 0; i < words[w].size(); i++)
+			{
+				int next = Find(node, words[w][i]);
+				if(next < 0)
+				{
+					next = static_cast<int>(trie.size());
+					trie.push_back(Node());
+					trie.back().word = -1;
+
+					vector<pair<char, unsigned int> >& siblings = trie[node].next;
+					pair<char, unsigned int> edge(words[w][i], static_cast<unsigned int>(next));
+					siblings.insert(lower_bound(siblings.begin(), siblings.end(), edge), edge);
+				}
+				node = static_cast<unsigned int>(next);
+			}
+			if(trie[node].word < 0)
+				trie[node].word = static_cast<int>(w);
+		}
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		_tree = 0;
+
+		Position start = _s->Where();
+
+		//Every word which is found along the path of the input in the trie
+		int word = -1;
+		if(!_s->AtEnd())
+		{
+			const char* next = _s->Peek(longest);
+			unsigned int node = 0;
+			for(unsigned int i = 0; ; i++)
+			{
+				Found(node, word);
+				if(i == longest)
+					break;
+
+				int child = -1;
+				if(next)
+				{
+					child = Find(node, next[i]);
+				}
+				else if(!_s->AtEnd())
+				{
+					child = Find(node, _s->Get());
+					_s->Next();
+				}
+				if(child < 0)
+					break;
+				node = static_cast<unsigned int>(child);
+			}
+
+			if(!next)
+				_s->Goto(start);
+		}
+
+		if(word < 0)
+		{
+			ErrorHandle e = 0;
+			for(unsigned int i = 0; i < expected.size(); i++)
+				e = _c.Merge(e, _c.Fail(expected[i], start));
+			return Failure(e);
+		}
+
+		for(unsigned int i = 0; i < words[word].size(); i++)
+			_s->Next();
+
+		_tree = new STNode(start, words[word]);
+		return Success();
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis&)
+	{
+		for(unsigned int i = 0; i < words.size(); i++)
+		{
+			if(words[i].empty())
+				_firsts.nullable = true;
+			else
+				_firsts.Add(words[i][0]);
+		}
+	}
+	virtual string Signature(Optimizer&)
+	{
+		string signature = "Keywords(";
+		for(unsigned int i = 0; i < words.size(); i++)
+			signature += Quoted(words[i]);
+		return signature + ")";
+	}
+};
+
+class EmptyParser : public Parser
+{
+public:
+	virtual Result Parse(ParseContext&, STNode*& _tree)
+	{
+		_tree = 0;
+		return Success();
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis&)
+	{
+		_firsts.nullable = true;
+	}
+	virtual string Signature(Optimizer&)
+	{
+		return "Empty()";
+	}
+};
+
+class AnyParser : public Parser
+{
+	Expectation expected;
+public:
+	AnyParser()
+		: expected(Expect("ANY"))
+	{
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		_tree = 0;
+		if(_s->AtEnd())
+			return Failure(_c.Fail(expected, _s->Where()));
+
+		_tree = new STNode(_s->Where(), string(1, _s->Get()));
+		_s->Next();
+		return Success();
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis&)
+	{
+		Firsts all;
+		all.Anything();
+		_firsts.AddChars(all);
+	}
+	virtual string Signature(Optimizer&)
+	{
+		return "Any()";
+	}
+};
+
+class EndOfInputParser : public Parser
+{
+	Expectation expected;
+public:
+	EndOfInputParser()
+		: expected(Expect("EOI"))
+	{
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		_tree = 0;
+		return _s->AtEnd() ? 
+			Success() : 
+			Failure(_c.Fail(expected, _s->Where()));
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis&)
+	{
+		_firsts.nullable = true;
+	}
+	virtual string Signature(Optimizer&)
+	{
+		return "EndOfInput()";
+	}
+};
+
+
+
+
+/**
+* @brief Whether _p is a basic parser, which reads the input without any other parser, so that memorizing it doesn't pay.
+*/
+static bool Basic(Parser* _p)
+{
+	return dynamic_cast<CharParser*>(_p) || dynamic_cast<WordParser*>(_p) || dynamic_cast<KeywordsParser*>(_p) ||
+		   dynamic_cast<EmptyParser*>(_p) || dynamic_cast<AnyParser*>(_p) || dynamic_cast<EndOfInputParser*>(_p);
+}
+
+class CheckParser : public Parser
+{
+	Parser* p;
+	bool present;
+public:
+	CheckParser(Parser* _p, bool _present)
+		: p(_p), present(_present)
+	{
+	}
+	virtual ~CheckParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		Position start = _s->Where();
+	
+		Result r = p->Parse(_c, _tree);
+
+		delete _tree;
+		_tree = 0;
+
+		_s->Goto(start);
+		
+		if(r.aborted)
+			return r;
+
+		return present ? r : !r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis&)
+	{
+		_firsts.nullable = true;
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return (present ? "At(" : "NotAt(") + _optimizer.Id(p) + ")";
+	}
+};
+
+
+static STNode* Colapse(STNode* _node)
+{
+	if(_node->IsLeaf())
+	{
+		delete _node;
+		return 0;
+	}
+	else if(_node->Sons() == 1)
+	{
+		STNode* son = _node->Son(0);
+		_node->UnlinkAll();
+		delete _node;
+		_node = son;
+	}
+
+	return _node;
+}
+
+class RepeatParser : public Parser
+{
+	Parser* p;
+	int minN;
+	int maxN;
+
+public:
+	RepeatParser(Parser* _p, int _minN, int _maxN)
+		: p(_p), minN(_minN), maxN(_maxN)
+	{
+	}
+	virtual ~RepeatParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		_tree = 0;
+		Position start = _s->Where();
+
+		STNode* repetition = new STNode(_s->Where());
+		ErrorHandle e = 0;
+
+		//Mandatory part
+		int i = 0;
+		for(; i < minN; i++)
+		{
+			STNode* t = 0;
+			Result r = p->Parse(_c, t);
+			e = _c.Merge(e, r.error);
+			if(!r)
+			{
+				_s->Goto(start);
+				delete repetition;
+				return r.aborted ? r : Failure(e);
+			}
+
+			repetition->AddSon(t);
+		}
+
+		//Optional part
+		for(; (i < maxN) || (maxN == -1); i++)
+		{
+			if(_c.Abort())
+			{
+				_s->Goto(start);
+				delete repetition;
+				return Aborted();
+			}
+
+			STNode* t = 0;
+			Result r = p->Parse(_c, t);
+			e = _c.Merge(e, r.error);
+			if(r.aborted)
+			{
+				_s->Goto(start);
+				delete repetition;
+				return r;
+			}
+			if(!r)
+				break;
+			repetition->AddSon(t);
+		}
+
+		_tree = Colapse(repetition);
+		return Success(e);
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		Firsts item;
+		p->First(item, _analysis);
+		_firsts.AddChars(item);
+		if(item.nullable || minN <= 0)
+			_firsts.nullable = true;
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Repeat(" + to_string(minN) + "," + to_string(maxN) + "," + _optimizer.Id(p) + ")";
+	}
+};
+
+class SequenceParser : public Parser
+{
+	vector<Parser*> ps;
+public:
+	SequenceParser(const vector<Parser*> _ps)
+		: ps(_ps)
+	{
+	}
+	virtual ~SequenceParser()
+	{
+		for(unsigned int i = 0; i < ps.size(); i++)
+			delete ps[i];
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		_tree = 0;
+		Position start = _s->Where();
+
+		STNode* sequence = new STNode(_s->Where());
+		ErrorHandle e = 0;
+
+		for(unsigned int i = 0; i < ps.size(); i++)
+		{
+			Parser* p = ps[i];
+			STNode* t = 0;
+			Result r = p->Parse(_c, t);
+			e = _c.Merge(e, r.error);			
+			if(!r)
+			{
+				_s->Goto(start);
+				delete sequence;
+				return r.aborted ? r : Failure(e);
+			}
+
+			sequence->AddSon(t);
+		}
+
+		_tree = Colapse(sequence);
+		return Success(e);
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		//Up to the first parser which must consume input
+		for(unsigned int i = 0; i < ps.size(); i++)
+		{
+			Firsts item;
+			ps[i]->First(item, _analysis);
+			_firsts.AddChars(item);
+			if(!item.nullable)
+				return;
+		}
+		_firsts.nullable = true;
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		for(unsigned int i = 0; i < ps.size(); i++)
+			ps[i] = _optimizer.Optimize(ps[i]);
+		if(!_optimizer.Rewrites() || _optimizer.Shared(this) || ps.size() != 1)
+			return this;
+
+		//The tree of a single parser is kept as it is
+		Parser* q = ps[0];
+		ps.clear();
+		_optimizer.Replaced(this);
+		return q;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		string signature = "Sequence(";
+		for(unsigned int i = 0; i < ps.size(); i++)
+			signature += _optimizer.Id(ps[i]) + ",";
+		return signature + ")";
+	}
+};
+
+class ChoiceParser : public Parser
+{
+protected:
+	vector<Parser*> ps;
+
+	//Dispatch of parses without diagnostics, built on the first one, once references are all set
+	once_flag					 analyzed;
+	vector<vector<unsigned int>> viables;	//!< Distinct lists of alternatives which may succeed, in order
+	unsigned int				 by[257];	//!< Index in viables for each char, by its unsigned value, and at the end of input
+
+	void Analyze()
+	{
+		vector<Firsts> firsts(ps.size());
+		FirstsAnalysis analysis;
+		for(unsigned int i = 0; i < ps.size(); i++)
+			ps[i]->First(firsts[i], analysis);
+
+		map<vector<unsigned int>, unsigned int> indexes;
+		for(unsigned int c = 0; c <= 256; c++)
+		{
+			vector<unsigned int> viable;
+			for(unsigned int i = 0; i < ps.size(); i++)
+			{
+				if(firsts[i].nullable || (c < 256 && firsts[i].chars[c]))
+					viable.push_back(i);
+			}
+
+			map<vector<unsigned int>, unsigned int>::iterator found = indexes.find(viable);
+			if(found == indexes.end())
+			{
+				found = indexes.insert(make_pair(viable, static_cast<unsigned int>(viables.size()))).first;
+				viables.push_back(viable);
+			}
+			by[c] = found->second;
+		}
+	}
+public:
+	ChoiceParser(const vector<Parser*> _ps)
+		: ps(_ps)
+	{
+	}
+	virtual ~ChoiceParser()
+	{
+		for(unsigned int i = 0; i < ps.size(); i++)
+			delete ps[i];
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		_tree = 0;
+		ErrorHandle e = 0;
+
+		//Without diagnostics, failing alternatives don't tell anything, so those which can't succeed are skipped
+		if(!_c.Diagnoses() && !_c.Recovers())
+		{
+			call_once(analyzed, &ChoiceParser::Analyze, this);
+
+			Stream* _s = _c.Input();
+			const vector<unsigned int>& viable = viables[by[_s->AtEnd() ? 256 : static_cast<unsigned char>(_s->Get())]];
+			for(unsigned int i = 0; i < viable.size(); i++)
+			{
+				STNode* t = 0;
+				Result r = ps[viable[i]]->Parse(_c, t);
+				if(r)
+				{
+					_tree = t;
+					return r;
+				}
+				if(r.aborted)
+					return r;
+			}
+
+			return Failure(e);
+		}
+		
+		for(unsigned int i = 0; i < ps.size(); i++)
+		{
+			Parser* p = ps[i];
+			STNode* t= 0;
+			Result r = p->Parse(_c, t);
+			e = _c.Merge(e, r.error);
+			if(r)
+			{
+				_tree = t;
+				return r;
+			}
+			if(r.aborted)
+				return r;
+		}
+		
+		return Failure(e);
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		for(unsigned int i = 0; i < ps.size(); i++)
+			ps[i]->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		for(unsigned int i = 0; i < ps.size(); i++)
+			ps[i] = _optimizer.Optimize(ps[i]);
+		if(!_optimizer.Rewrites() || _optimizer.Shared(this))
+			return this;
+
+		//Consecutive alternatives of single chars are fused
+		vector<Parser*> fused;
+		for(unsigned int i = 0; i < ps.size(); i++)
+		{
+			CharParser* last = fused.empty() ? 0 : dynamic_cast<CharParser*>(fused.back());
+			CharParser* next = dynamic_cast<CharParser*>(ps[i]);
+			if(last && next && !_optimizer.Shared(last) && !_optimizer.Shared(next))
+			{
+				fused.back() = new CharParser(*last, *next);
+				_optimizer.Replaced(last);
+				_optimizer.Replaced(next);
+			}
+			else
+			{
+				fused.push_back(ps[i]);
+			}
+		}
+		ps = fused;
+		if(ps.size() != 1)
+			return this;
+
+		Parser* q = ps[0];
+		ps.clear();
+		_optimizer.Replaced(this);
+		return q;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		string signature = "Choice(";
+		for(unsigned int i = 0; i < ps.size(); i++)
+			signature += _optimizer.Id(ps[i]) + ",";
+		return signature + ")";
+	}
+};
+
+
+class ReferenceParser : public Parser
+{
+	Parser** p;
+public:
+	ReferenceParser(Parser** _p)
+		: p(_p)
+	{
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		return (*p)->Parse(_c, _tree);
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		//Left recursion: the analysis under way is what is found, so anything is told
+		vector<Parser*>& visiting = _analysis.visiting;
+		if(find(visiting.begin(), visiting.end(), *p) != visiting.end())
+		{
+			_firsts.Anything();
+			return;
+		}
+
+		//Each rule is analyzed once, however many paths reach it, as those of layered rules do
+		map<Parser*, Firsts>::iterator rule = _analysis.rules.find(*p);
+		if(rule == _analysis.rules.end())
+		{
+			visiting.push_back(*p);
+			Firsts firsts;
+			(*p)->First(firsts, _analysis);
+			visiting.pop_back();
+			rule = _analysis.rules.insert(make_pair(*p, firsts)).first;
+		}
+
+		_firsts.AddChars(rule->second);
+		_firsts.nullable = _firsts.nullable || rule->second.nullable;
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		if(!_optimizer.Rewrites())
+		{
+			_optimizer.Refers(p);
+			return this;
+		}
+
+		Parser* q = _optimizer.Shared(this) ? 0 : _optimizer.Inlined(p);
+		if(!q)
+			return this;
+
+		//Its rule isn't recursive, so the parser of the rule is used right here
+		_optimizer.Replaced(this);
+		return q;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Reference(" + _optimizer.Id(static_cast<const void*>(p)) + ")";
+	}
+};
+
+class TokenParser : public Parser
+{
+	Parser* p;
+
+	class Stringifier : public TreeVisitor
+	{
+		string result;
+	public:
+		bool Visit(STNode* _node, unsigned int _level)
+		{
+			if(!_node->childs.size())
+				result += _node->data;
+
+			return true;
+		}
+		string GetResult()
+		{
+			return result;
+		}
+	};
+
+public:
+	TokenParser(Parser* _p)
+		: p(_p)
+	{
+	}
+	virtual ~TokenParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		Position start = _s->Where();
+		bool diagnose = _c.Diagnoses();
+		ParseContext::ErrorMark mark;
+		if(diagnose)
+			mark = _c.Mark();
+
+		Result r = p->Parse(_c, _tree);
+		if(diagnose)
+		{
+			if(r && _tree)
+				_c.Drop(mark);
+			else
+				_c.Keep(mark);
+		}
+		if(r && _tree)
+		{
+			Stringifier s;
+			PreWalk(_tree, &s);
+			delete _tree;
+			_tree = new STNode(start, s.GetResult());
+			return Success();
+		}
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Token(" + _optimizer.Id(p) + ")";
+	}
+};
+
+class IgnoreParser : public Parser
+{
+	Parser* p;
+
+public:
+	IgnoreParser(Parser* _p)
+		: p(_p)
+	{
+	}
+	virtual ~IgnoreParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Result r = p->Parse(_c, _tree);
+		delete _tree;
+		_tree = 0;
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		if(!_optimizer.Rewrites() || _optimizer.Shared(this) || !dynamic_cast<IgnoreParser*>(p))
+			return this;
+
+		//Its parser ignores already
+		Parser* q = p;
+		p = 0;
+		_optimizer.Replaced(this);
+		return q;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Ignore(" + _optimizer.Id(p) + ")";
+	}
+	/**
+	* @brief Gives away its parser, for Optimize to fold this one into the parser using it.
+	*/
+	Parser* Release()
+	{
+		Parser* q = p;
+		p = 0;
+		return q;
+	}
+};
+
+class ClearParser : public Parser
+{
+	Parser* p;
+	bool	ignores; //!< Whether the tree is dropped too, as an Ignore folded into this did
+
+public:
+	ClearParser(Parser* _p)
+		: p(_p), ignores(false)
+	{
+	}
+	virtual ~ClearParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Result r;
+		if(!_c.Diagnoses())
+		{
+			r = p->Parse(_c, _tree);
+		}
+		else
+		{
+			ParseContext::ErrorMark mark = _c.Mark();
+			r = p->Parse(_c, _tree).Clear();
+			_c.Drop(mark);
+		}
+
+		if(ignores)
+		{
+			delete _tree;
+			_tree = 0;
+		}
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		if(!_optimizer.Rewrites() || _optimizer.Shared(this))
+			return this;
+
+		//Its parser ignores: the tree is dropped here instead, saving a call
+		IgnoreParser* ignore = dynamic_cast<IgnoreParser*>(p);
+		if(ignore && !_optimizer.Shared(ignore))
+		{
+			p = ignore->Release();
+			ignores = true;
+			_optimizer.Replaced(ignore);
+		}
+
+		ClearParser* clear = dynamic_cast<ClearParser*>(p);
+		if(!clear || (ignores && !clear->ignores))
+			return this;
+
+		//Its parser clears already
+		Parser* q = p;
+		p = 0;
+		_optimizer.Replaced(this);
+		return q;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return (ignores ? "ClearIgnore(" : "Clear(") + _optimizer.Id(p) + ")";
+	}
+};
+
+/**
+* @brief Hands out the slots of MemoryParsers in ParseContexts, reusing those of destroyed parsers so that slots stay dense.
+*/
+class SlotRegistry
+{
+	mutex				 lock;
+	unsigned int		 next;
+	vector<unsigned int> released;
+public:
+	SlotRegistry()
+		: next(0)
+	{
+	}
+	unsigned int Acquire()
+	{
+		lock_guard<mutex> guard(lock);
+
+		if(released.empty())
+			return next++;
+
+		unsigned int slot = released.back();
+		released.pop_back();
+		return slot;
+	}
+	void Release(unsigned int _slot)
+	{
+		lock_guard<mutex> guard(lock);
+
+		released.push_back(_slot);
+	}
+};
+
+static SlotRegistry& Slots()
+{
+	static SlotRegistry slots;
+	return slots;
+}
+
+class MemoTable
+{
+	struct Memorization  
+	{
+		Result result;
+		Position newPosition;
+		Position examined; //!< Furthest position examined, when tracked
+		STNode* tree;
+		Position farthest; //!< Of the failures recorded, when diagnosing
+		vector<Expectation> expected;
+
+		Memorization(const Result& _r, const Position& _p, const Position& _examined, STNode* _tree)
+			: result(_r), newPosition(_p), examined(_examined), tree(_tree)
+		{}
+	};
+
+	map<Position, Memorization> memory;
+
+	STNode* Copy(STNode* _node)
+	{
+		if(!_node)
+			return 0;
+
+		STNode* newNode = new STNode(_node->where, _node->data);
+		for(unsigned int i = 0; i < _node->Sons(); i++)
+			newNode->AddSon(Copy(_node->Son(i)));
+		return newNode;
+	}
+
+	/**
+	* @brief Where _p, at or after _last, is once the text in [_first, _last) has been replaced by text ending at _end.
+	*/
+	static Position Shift(const Position& _p, const Position& _last, const Position& _end)
+	{
+		if(_p.row == _last.row)
+			return Position(_end.row, _end.column + _p.column - _last.column);
+
+		return Position(_p.row - _last.row + _end.row, _p.column);
+	}
+	static void Shift(STNode* _node, const Position& _last, const Position& _end)
+	{
+		if(!_node)
+			return;
+
+		_node->where = Shift(_node->where, _last, _end);
+		for(unsigned int i = 0; i < _node->Sons(); i++)
+			Shift(_node->Son(i), _last, _end);
+	}
+public:
+	~MemoTable()
+	{
+		Clear();
+	}
+	void Clear()
+	{
+		//Must walk deleting trees as they're copied
+		for(map<Position, Memorization>::iterator i = memory.begin(); i != memory.end(); i++)
+		{
+			delete i->second.tree;
+		}
+
+		memory.clear();
+	}
+	bool Remember(const Position& _position, Result& _result, Position& _newPosition, Position& _examined, STNode*& _tree,
+				  ParseContext& _c)
+	{
+		map<Position, Memorization>::iterator i = memory.find(_position);
+		if (i == memory.end())
+			return false;
+
+		_result      = i->second.result;
+		_newPosition = i->second.newPosition;
+		_examined    = i->second.examined;
+		_tree        = Copy(i->second.tree);
+		if(!i->second.expected.empty())
+			_c.Replay(i->second.farthest, i->second.expected);
+		return true;
+	}
+	/**
+	* @brief Memorizes a result, with the failures recorded by its parse when diagnosing, since the innermost mark of _c.
+	*/
+	void Memorize(const Position& _position, const Result& _result, const Position& _newPosition, const Position& _examined, STNode* _tree,
+				  ParseContext& _c)
+	{
+		map<Position, Memorization>::iterator i = memory.find(_position);
+		if (i == memory.end())
+		{
+			i = memory.insert(pair<Position, Memorization>(_position, Memorization(_result, _newPosition, _examined, Copy(_tree)))).first;
+			if(_c.Diagnoses())
+				_c.Recorded(i->second.farthest, i->second.expected);
+		}
+	}
+	/**
+	* @brief Forgets the results which examined [_first, _last), replaced by text ending at _end, and moves those after it.
+	*/
+	void Edit(const Position& _first, const Position& _last, const Position& _end)
+	{
+		map<Position, Memorization> edited;
+		for(map<Position, Memorization>::iterator i = memory.begin(); i != memory.end(); i++)
+		{
+			Memorization& m = i->second;
+			if(i->first < _first && m.examined < _first)
+			{
+				edited.insert(*i);
+			}
+			else if(!(i->first < _last))
+			{
+				m.newPosition = Shift(m.newPosition, _last, _end);
+				m.examined = Shift(m.examined, _last, _end);
+				Shift(m.tree, _last, _end);
+				edited.insert(pair<Position, Memorization>(Shift(i->first, _last, _end), m));
+			}
+			else
+			{
+				delete m.tree;
+			}
+		}
+
+		memory.swap(edited);
+	}
+	void Forget(const Position& _position)
+	{
+		map<Position, Memorization>::iterator end = memory.lower_bound(_position);
+		for(map<Position, Memorization>::iterator i = memory.begin(); i != end; i++)
+			delete i->second.tree;
+
+		memory.erase(memory.begin(), end);
+	}
+};
+
+/**
+* @brief Tokens found by ParseContext::Lex: for each token start, in order, whether each kind of token matches there.
+*/
+class TokenTable
+{
+public:
+	struct Match
+	{
+		int	   length; //!< Chars of the token, or -1 if it doesn't match
+		bool   node;   //!< Whether it has a tree, as empty tokens have not
+		string data;
+	};
+	struct Lexeme
+	{
+		size_t	 cursor; //!< Offset where the lexer was, before skipping what is ignored
+		size_t	 first;	 //!< Offset of the token start
+		Position where;	 //!< Of the token start
+	};
+
+	unsigned int   kinds;
+	vector<Lexeme> lexemes;
+	vector<Match>  matches; //!< Of lexemes[i], in [i * kinds, (i + 1) * kinds)
+
+	TokenTable(unsigned int _kinds)
+		: kinds(_kinds)
+	{
+	}
+	const Match* Find(const Position& _where, unsigned int _kind) const
+	{
+		size_t first = 0;
+		size_t last = lexemes.size();
+		while(first < last)
+		{
+			size_t middle = (first + last) / 2;
+			if(lexemes[middle].where < _where)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+
+		if(first == lexemes.size() || lexemes[first].where != _where)
+			return 0;
+		return &matches[first * kinds + _kind];
+	}
+	/**
+	* @brief Index of the lexeme lexed from _cursor, or -1 if there is none.
+	*/
+	size_t Lexed(size_t _cursor) const
+	{
+		size_t first = 0;
+		size_t last = lexemes.size();
+		while(first < last)
+		{
+			size_t middle = (first + last) / 2;
+			if(lexemes[middle].cursor < _cursor)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+
+		if(first == lexemes.size() || lexemes[first].cursor != _cursor)
+			return static_cast<size_t>(-1);
+		return first;
+	}
+	/**
+	* @brief Appends the lexemes of _table from the _from-th one.
+	*/
+	void Append(const TokenTable& _table, size_t _from)
+	{
+		lexemes.insert(lexemes.end(), _table.lexemes.begin() + _from, _table.lexemes.end());
+		matches.insert(matches.end(), _table.matches.begin() + _from * kinds, _table.matches.end());
+	}
+};
+
+/**
+* @brief Where the nestings and literals of a text end, as a Splitter tells. The text is read in place. @see ParseContext::Structure
+*/
+class StructureIndex
+{
+	enum Kind
+	{
+		PLAIN,
+		OPENER,
+		CLOSER,
+		QUOTE,
+		COMMENT
+	};
+
+	Splitter	   splitter;
+	const char*	   text;
+	size_t		   size;
+	Position	   start;
+	vector<size_t> lines;	 //!< Offset of the first char of each line
+	vector<size_t> openings; //!< Offset of each opener of a nesting or literal, in order
+	vector<size_t> ends;	 //!< One past the closer of each opening, or 0 if it isn't closed
+
+	/**
+	* @brief Column of the first char of the line with that index.
+	*/
+	unsigned int First(size_t _line) const
+	{
+		return _line ? 1 : start.column;
+	}
+public:
+	StructureIndex(const Splitter& _splitter, const char* _text, size_t _size, const Position& _start)
+		: splitter(_splitter), text(_text), size(_size), start(_start)
+	{
+		const char* first = text;
+		const char* last = first + size;
+
+		lines.push_back(0);
+		for(const char* end = first; (end = static_cast<const char*>(memchr(end, '\n', last - end))) != 0; end++)
+			lines.push_back(end + 1 - first);
+
+		unsigned char kinds[256] = {PLAIN};
+		for(size_t i = 0; i < splitter.nesting.size(); i++)
+			kinds[static_cast<unsigned char>(splitter.nesting[i])] = (i % 2) ? CLOSER : OPENER;
+		for(size_t i = 0; i < splitter.quotes.size(); i++)
+			kinds[static_cast<unsigned char>(splitter.quotes[i])] = QUOTE;
+		if(splitter.comment)
+			kinds[static_cast<unsigned char>(splitter.comment)] = COMMENT;
+
+		//As SplitScan does: any closer closes the innermost nesting, and literals and comments hide everything up to their end
+		vector<size_t> open;
+		for(const char* c = first; c < last; c++)
+		{
+			switch(kinds[static_cast<unsigned char>(*c)])
+			{
+			case OPENER:
+				open.push_back(openings.size());
+				openings.push_back(c - first);
+				ends.push_back(0);
+				break;
+			case CLOSER:
+				if(!open.empty())
+				{
+					ends[open.back()] = c + 1 - first;
+					open.pop_back();
+				}
+				break;
+			case QUOTE:
+				{
+					const char* closer = static_cast<const char*>(memchr(c + 1, *c, last - c - 1));
+					if(!closer)
+						return;
+					openings.push_back(c - first);
+					ends.push_back(closer + 1 - first);
+					c = closer;
+				}
+				break;
+			case COMMENT:
+				c = static_cast<const char*>(memchr(c, '\n', last - c));
+				if(!c)
+					return;
+				break;
+			}
+		}
+	}
+	/**
+	* @brief Whether it has been built as _splitter tells.
+	*/
+	bool Of(const Splitter& _splitter) const
+	{
+		return splitter.terminator == _splitter.terminator && splitter.nesting == _splitter.nesting &&
+			   splitter.quotes == _splitter.quotes && splitter.comment == _splitter.comment;
+	}
+	/**
+	* @brief Offset of a position of the text, or its size if it is out of it.
+	*/
+	size_t Offset(const Position& _where) const
+	{
+		if(_where < start || _where.row - start.row >= lines.size())
+			return size;
+
+		size_t line = _where.row - start.row;
+		size_t offset = lines[line] + _where.column - First(line);
+		return min(offset, size);
+	}
+	/**
+	* @brief Position of the char at _offset.
+	*/
+	Position At(size_t _offset) const
+	{
+		size_t line = upper_bound(lines.begin(), lines.end(), _offset) - lines.begin() - 1;
+		return Position(start.row + static_cast<unsigned int>(line), static_cast<unsigned int>(_offset - lines[line] + First(line)));
+	}
+	/**
+	* @brief One past the end of the nesting or literal opened at _offset, or 0 if none is.
+	*/
+	size_t End(size_t _offset) const
+	{
+		vector<size_t>::const_iterator i = lower_bound(openings.begin(), openings.end(), _offset);
+		return (i != openings.end() && *i == _offset) ? ends[i - openings.begin()] : 0;
+	}
+	const char* Text() const
+	{
+		return text;
+	}
+};
+
+ParseContext::~ParseContext()
+{
+	for(unsigned int i = 0; i < tables.size(); i++)
+		delete tables[i];
+	delete tokens;
+	for(unsigned int i = 0; i < structures.size(); i++)
+		delete structures[i];
+}
+
+void ParseContext::Restart(Stream* _s, bool _diagnose, bool _recover)
+{
+	input	 = _s;
+	diagnose = _diagnose;
+	recover	 = _recover;
+
+	expectations.clear();
+	first = 0;
+	kept  = 0;
+	recovered.clear();
+
+	aborted = false;
+	steps	= 0;
+
+	delete tokens;
+	tokens = 0;
+	for(unsigned int i = 0; i < structures.size(); i++)
+		delete structures[i];
+	structures.clear();
+	tracked = 0;
+
+	for(unsigned int i = 0; i < tables.size(); i++)
+	{
+		if(tables[i])
+			tables[i]->Clear();
+	}
+}
+
+TokenTable* ParseContext::Tokens()
+{
+	return tokens;
+}
+
+StructureIndex* ParseContext::Structure(const Splitter& _splitter)
+{
+	for(unsigned int i = 0; i < structures.size(); i++)
+	{
+		if(structures[i]->Of(_splitter))
+			return structures[i];
+	}
+
+	if(diagnose || recover || tracked)
+		return 0;
+
+	//Only an input held in memory is indexed, in place
+	size_t size = 0;
+	const char* rest = input->Rest(size);
+	if(!rest)
+		return 0;
+
+	structures.push_back(new StructureIndex(_splitter, rest, size, input->Where()));
+	return structures.back();
+}
+
+void ParseContext::Track(EditableStream* _s)
+{
+	tracked = _s;
+}
+
+EditableStream* ParseContext::Tracked()
+{
+	return tracked;
+}
+
+void ParseContext::Edited(const Position& _first, const Position& _last, const Position& _end)
+{
+	for(unsigned int i = 0; i < tables.size(); i++)
+	{
+		if(tables[i])
+			tables[i]->Edit(_first, _last, _end);
+	}
+}
+
+void ParseContext::Forget(const Position& _position)
+{
+	for(unsigned int i = 0; i < tables.size(); i++)
+	{
+		if(tables[i])
+			tables[i]->Forget(_position);
+	}
+}
+
+MemoTable* ParseContext::Table(unsigned int _slot)
+{
+	if(_slot >= tables.size())
+		tables.resize(_slot + 1, 0);
+
+	if(!tables[_slot])
+		tables[_slot] = new MemoTable();
+
+	return tables[_slot];
+}
+
+class MemoryParser : public Parser
+{
+	Parser* p;
+	unsigned int slot; //!< Of its MemoTable in every ParseContext.
+public:
+	MemoryParser(Parser* _p)
+		: p(_p), slot(Slots().Acquire())
+	{
+	}
+	virtual ~MemoryParser()
+	{
+		Slots().Release(slot);
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		if(_c.Abort())
+		{
+			_tree = 0;
+			return Aborted();
+		}
+
+		Stream* _s = _c.Input();
+		MemoTable* memory = _c.Table(slot);
+		EditableStream* tracked = _c.Tracked();
+
+		Result r;
+		Position n;
+		Position examined;
+		if(memory->Remember(_s->Where(), r, n, examined, _tree, _c))
+		{
+			if(n != _s->Where())
+				_s->Goto(n);
+			if(tracked)
+				tracked->Examined(examined);
+			
+			return r;
+		}
+		
+		Position start = _s->Where();
+		Position outer = tracked ? tracked->Examine(start) : start;
+
+		//When diagnosing, the failures of its parse are recorded apart, to be replayed whenever the result is remembered
+		ParseContext::ErrorMark mark;
+		if(_c.Diagnoses())
+			mark = _c.Mark();
+
+		r = p->Parse(_c, _tree);
+
+		if(tracked)
+		{
+			examined = tracked->Reach();
+			tracked->Examined(outer);
+		}
+
+		if(!r.aborted)
+			memory->Memorize(start, r, _s->Where(), examined, _tree, _c);
+
+		if(_c.Diagnoses())
+			_c.Keep(mark);
+
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		if(!_optimizer.Rewrites() || _optimizer.Shared(this) || !(Basic(p) || dynamic_cast<MemoryParser*>(p)))
+			return this;
+
+		//Not worth memorizing, or memorized already
+		Parser* q = p;
+		p = 0;
+		_optimizer.Replaced(this);
+		return q;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Memory(" + _optimizer.Id(p) + ")";
+	}
+};
+
+
+
+Parser* Char(const Set& _set)		{return new CharParser(_set);}
+Parser* Word(const string& _word)	{return new MemoryParser(new WordParser(_word));}
+Parser* Empty()						{return new EmptyParser();}
+Parser* Any()						{return new AnyParser();}
+Parser* EndOfInput()				{return new EndOfInputParser();}
+
+Parser* At		(Parser* _p)						{return new MemoryParser(new CheckParser(_p, true));}
+Parser* NotAt	(Parser* _p)						{return new MemoryParser(new CheckParser(_p, false));}
+Parser* Optional(Parser* _p)						{return new MemoryParser(new RepeatParser(_p, 0, 1));}
+Parser* Star	(Parser* _p)						{return new MemoryParser(new RepeatParser(_p, 0, -1));}
+Parser* Plus	(Parser* _p)						{return new MemoryParser(new RepeatParser(_p, 1, -1));}
+Parser* Repeat	(int _minN, int _maxN, Parser* _p)	{return new MemoryParser(new RepeatParser(_p, _minN, _maxN));}
+Parser* Sequence(unsigned int _number, ...)
+{
+	va_list arguments;                     
+	vector<Parser*> ps;
+
+	va_start(arguments, _number);           
+	for(unsigned int i = 0; i < _number; i++)
+	{
+		ps.push_back(va_arg(arguments, Parser*)); 
+	}
+	va_end(arguments);
+
+	return new MemoryParser(new SequenceParser(ps));
+}
+Parser* Choice	(unsigned int _number, ...)
+{
+	va_list arguments;                     
+	vector<Parser*> ps;
+
+	va_start(arguments, _number);           
+	for(unsigned int i = 0; i < _number; i++)
+	{
+		ps.push_back(va_arg(arguments, Parser*)); 
+	}
+	va_end(arguments);
+
+	return new MemoryParser(new ChoiceParser(ps));
+}
+Parser* Keywords(unsigned int _number, ...)
+{
+	va_list arguments;
+	vector<string> words;
+
+	va_start(arguments, _number);
+	for(unsigned int i = 0; i < _number; i++)
+	{
+		words.push_back(va_arg(arguments, const char*));
+	}
+	va_end(arguments);
+
+	return new MemoryParser(new KeywordsParser(words));
+}
+
+Parser* Reference	(Parser** _p)	{return new ReferenceParser(_p);}
+Parser* Token		(Parser* _p)	{return new TokenParser(_p);}
+Parser* Ignore		(Parser* _p)	{return new IgnoreParser(_p);}
+Parser* Clear		(Parser* _p)	{return new ClearParser(_p);}
+
+
+const char* const ERROR_NODE = "<ERROR>";
+
+class RecoverParser : public Parser
+{
+	Parser* sync;
+	Parser* p;
+
+public:
+	RecoverParser(Parser* _sync, Parser* _p)
+		: sync(_sync), p(_p)
+	{
+	}
+	virtual ~RecoverParser()
+	{
+		delete sync;
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		Position start = _s->Where();
+		if(!_c.Recovers())
+			return p->Parse(_c, _tree);
+
+		//Errors of _p alone are the ones skipped
+		ParseContext::ErrorMark mark = _c.Mark();
+		Result r = p->Parse(_c, _tree);
+		if(r || r.aborted)
+		{
+			_c.Keep(mark);
+			return r;
+		}
+
+		//Skip until synchronization point, whose failures don't count
+		_s->Goto(start);
+		ParseContext::ErrorMark skipping = _c.Mark();
+		while(!_s->AtEnd())
+		{
+			STNode* t = 0;
+			Result q = sync->Parse(_c, t);
+			delete t;
+			if(q)
+				break;
+			if(q.aborted)
+			{
+				_c.Drop(skipping);
+				_c.Keep(mark);
+				return q;
+			}
+			_s->Next();
+		}
+		_c.Drop(skipping);
+
+		if(_s->Where() == start)
+		{
+			_c.Keep(mark);
+			return r;
+		}
+
+		Error error = _c.Report(r.error);
+		_c.Drop(mark);
+		_c.Recovered(start, error);
+		_tree = new STNode(start, ERROR_NODE);
+		return Success();
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		sync = _optimizer.Optimize(sync);
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Recover(" + _optimizer.Id(sync) + "," + _optimizer.Id(p) + ")";
+	}
+};
+
+Parser* Recover		(Parser* _sync, Parser* _p)	{return new RecoverParser(_sync, _p);}
+
+class LexedParser : public Parser
+{
+	unsigned int kind;
+	Parser*		 p;
+public:
+	LexedParser(unsigned int _kind, Parser* _p)
+		: kind(_kind), p(_p)
+	{
+	}
+	virtual ~LexedParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		TokenTable* table = _c.Tokens();
+		const TokenTable::Match* match = table ? table->Find(_s->Where(), kind) : 0;
+		if(!match)
+			return p->Parse(_c, _tree);
+
+		_tree = 0;
+		if(match->length < 0)
+			return Failure(0);
+
+		if(match->node)
+			_tree = new STNode(_s->Where(), match->data);
+		for(int i = 0; i < match->length; i++)
+			_s->Next();
+		return Success();
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Lexed(" + to_string(kind) + "," + _optimizer.Id(p) + ")";
+	}
+};
+
+Parser* Lexed		(unsigned int _kind, Parser* _p) {return new LexedParser(_kind, _p);}
+
+
+class NameParser : public Parser
+{
+	Parser* p;
+	string name;
+	bool insert;
+public:
+	NameParser(Parser* _p, const string& _name, bool _insert)
+		: p(_p), name(_name), insert(_insert)
+	{
+	}
+	virtual ~NameParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Stream* _s = _c.Input();
+		Position start = _s->Where();
+
+		Result r = p->Parse(_c, _tree);
+
+		if(!r)
+			return r;
+
+		if(!_tree)
+		{
+			if(insert)
+				_tree = new STNode(start, name);
+			return r;
+		}
+
+		if(_tree->HasData())
+		{
+			if(insert)
+			{
+				STNode* n = new STNode(_tree->where, name);
+				n->AddSon(_tree);
+				_tree = n;
+			}
+		}
+		else
+			_tree->data = name;
+
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Name(" + Quoted(name) + "," + to_string(insert) + "," + _optimizer.Id(p) + ")";
+	}
+};
+
+
+class RootParser : public Parser
+{
+	Parser* p;
+	int index;
+	
+public:
+	RootParser(Parser* _p, int _index)
+		: p(_p), index(_index)
+	{
+	}
+	virtual ~RootParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Result r = p->Parse(_c, _tree);
+
+		if(!_tree || _tree->HasData())
+			return r;
+
+		if(static_cast<unsigned int>((abs(index) - 1)) >= _tree->Sons())
+			return r;
+
+		if(index == 0)
+			return r;
+
+
+		int real_index = index > 0 ? index - 1 : (_tree->Sons() + index);
+		STNode* son = _tree->Son(real_index);
+		_tree->Unlink(son);
+		_tree->Merge(son, real_index);
+		_tree->data = son->data;
+		_tree->where = son->where;
+		delete son;
+
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Root(" + to_string(index) + "," + _optimizer.Id(p) + ")";
+	}
+};
+
+class FlatParser : public Parser
+{
+	Parser* p;
+	int index;
+
+	class Flatenizer : public TreeVisitor
+	{
+		STNode* result;
+	public:
+		Flatenizer(const Position& _originalNodePosition)
+			: result(new STNode(_originalNodePosition))
+		{
+		}
+		bool Visit(STNode* _node, unsigned int _level)
+		{
+			if(_node->HasData())
+			{
+				result->AddSon(_node);
+				return false;
+			}
+
+			return true;
+		}
+		STNode* GetResult()
+		{
+			return result;
+		}
+	};
+
+	class Unlinker : public TreeVisitor
+	{
+	public:
+		bool Visit(STNode* _node, unsigned int _level)
+		{
+			if(_node->HasData())
+				return false;
+
+			_node->UnlinkAll();
+			delete _node;
+			return true;
+		}
+	};
+
+public:
+	FlatParser(Parser* _p, int _index)
+		: p(_p), index(_index)
+	{
+	}
+	virtual ~FlatParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Result r = p->Parse(_c, _tree);
+
+		if(!_tree || _tree->HasData())
+			return r;
+
+		if(static_cast<unsigned int>((abs(index) - 1)) >= _tree->Sons())
+			return r;
+
+		if(index == 0)
+			return r;
+
+		int real_index = index > 0 ? index - 1 : (_tree->Sons() + index);
+		STNode* son = _tree->Son(real_index);
+		if(son->HasData())
+			return r;
+
+		_tree->Unlink(son);
+
+		Flatenizer f(son->where);
+		PreWalk(son, &f);
+		
+		_tree->Merge(f.GetResult(), real_index);
+
+		Unlinker u;
+		PostWalk(son, &u);
+
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Flat(" + to_string(index) + "," + _optimizer.Id(p) + ")";
+	}
+};
+
+class LeftParser : public Parser
+{
+	Parser* p;
+
+public:
+	LeftParser(Parser* _p)
+		: p(_p)
+	{
+	}
+	virtual ~LeftParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Result r = p->Parse(_c, _tree);
+
+		if(!_tree || _tree->HasData())
+			return r;
+
+		if(_tree->Sons() % 2 == 0)
+			return r;
+
+		for(unsigned int i = 1; i < _tree->Sons(); i += 2)
+		{
+			if(!_tree->Son(i)->IsLeaf())
+				return r;
+		}
+
+		for(unsigned int i = 1; i < _tree->Sons(); i += 2)
+		{
+			STNode* op = _tree->Son(i);
+			if(i == 1)
+				op->AddSon(_tree->Son(i - 1));
+			else
+				op->AddSon(_tree->Son(i - 2));
+			op->AddSon(_tree->Son(i + 1));
+		}
+
+		STNode* old = _tree;
+		
+		_tree = _tree->Son(_tree->Sons() - 2);
+		
+		old->UnlinkAll();
+		delete old;
+
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Left(" + _optimizer.Id(p) + ")";
+	}
+};
+
+class RightParser : public Parser
+{
+	Parser* p;
+
+public:
+	RightParser(Parser* _p)
+		: p(_p)
+	{
+	}
+	virtual ~RightParser()
+	{
+		delete p;
+	}
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
+	{
+		Result r = p->Parse(_c, _tree);
+
+		if(!_tree || _tree->HasData())
+			return r;
+
+		if(_tree->Sons() % 2 == 0)
+			return r;
+
+		for(unsigned int i = 1; i < _tree->Sons(); i += 2)
+		{
+			if(!_tree->Son(i)->IsLeaf())
+				return r;
+		}
+
+		for(int i = _tree->Sons() - 2; i > 0; i -= 2)
+		{
+			STNode* op = _tree->Son(i);
+			op->AddSon(_tree->Son(i - 1));
+
+			if(i == _tree->Sons() - 2)
+				op->AddSon(_tree->Son(i + 1));
+			else
+				op->AddSon(_tree->Son(i + 2));
+		}
+
+		STNode* old = _tree;
+
+		_tree = _tree->Son(1);
+
+		old->UnlinkAll();
+		delete old;
+
+		return r;
+	}
+	virtual void First(Firsts& _firsts, FirstsAnalysis& _analysis)
+	{
+		p->First(_firsts, _analysis);
+	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Right(" + _optimizer.Id(p) + ")";
+	}
+};
+
+Parser* Name (const string& _name, bool _insert, Parser* _p){return new NameParser(_p, _name, _insert);}
+Parser* Root (int _index, Parser* _p)						{return new RootParser(_p, _index);}
+Parser* Flat (int _index, Parser* _p)						{return new FlatParser(_p, _index);}
+Parser* Left (Parser* _p)									{return new LeftParser(_p);}
+Parser* Right(Parser* _p)									{return new RightParser(_p);}
+
+
+
+Parsed::Parsed(unsigned int _index)
+	: index(_index), tree(0)
+{
+}
+
+BatchListener::~BatchListener() {}
+
+/**
+* @brief Whether the current thread is running tasks of a WorkStealing, so that parsers don't spread their work over threads again.
+*/
+static thread_local bool pooled = false;
+
+/**
+* @brief Runs tasks, numbered [0, n), on a set of threads. Each thread starts with a contiguous block of tasks in its own queue,
+* taking them from the front. Once empty, it steals from the back of the queues of the others, until every queue is empty.
+* The calling thread runs as the first worker, and the threads of the ThreadPool idle at the time help as the others, so that
+* threads are never started for a run, and a run never waits for a busy thread.
+*/
+class WorkStealing
+{
+public:
+	/**
+	* @brief Runs the tasks of a thread, keeping whatever state it needs from a task to the next.
+	*/
+	class Worker
+	{
+	public:
+		virtual ~Worker() {}
+		virtual void Run(unsigned int _task) = 0;
+	};
+
+private:
+	struct Queue
+	{
+		mutex				 lock;
+		deque<unsigned int>	 tasks;
+	};
+
+	vector<Worker*>		workers;
+	vector<Queue>		queues;
+	unsigned int		joined;	 //!< Workers taken by a thread. Guarded by the lock of the ThreadPool.
+	unsigned int		helping; //!< Threads of the ThreadPool helping.
+	mutex				lock;
+	condition_variable	helped;
+
+	bool Take(unsigned int _queue, bool _front, unsigned int& _task)
+	{
+		lock_guard<mutex> guard(queues[_queue].lock);
+
+		deque<unsigned int>& tasks = queues[_queue].tasks;
+		if(tasks.empty())
+			return false;
+
+		if(_front)
+		{
+			_task = tasks.front();
+			tasks.pop_front();
+		}
+		else
+		{
+			_task = tasks.back();
+			tasks.pop_back();
+		}
+		return true;
+	}
+
+	void Work(unsigned int _worker)
+	{
+		unsigned int n = static_cast<unsigned int>(queues.size());
+		unsigned int task = 0;
+
+		for(;;)
+		{
+			bool found = Take(_worker, true, task);
+			for(unsigned int i = 1; !found && i < n; i++)
+				found = Take((_worker + i) % n, false, task);
+
+			//No task is ever added, so once every queue is empty, we're done
+			if(!found)
+				return;
+
+			workers[_worker]->Run(task);
+		}
+	}
+
+public:
+	WorkStealing(const vector<Worker*>& _workers, unsigned int _tasks)
+		: workers(_workers), queues(_workers.size()), joined(1), helping(0)
+	{
+		unsigned long long n = workers.size();
+		for(unsigned int t = 0; t < _tasks; t++)
+			queues[static_cast<unsigned int>(t * n / _tasks)].tasks.push_back(t);
+	}
+	void Run();
+
+	/**
+	* @brief Takes a worker for a thread of the ThreadPool, if any is left. Called with the lock of the ThreadPool.
+	*/
+	bool Join(unsigned int& _worker)
+	{
+		if(joined >= workers.size())
+			return false;
+
+		_worker = joined++;
+		lock_guard<mutex> guard(lock);
+		helping++;
+		return true;
+	}
+	/**
+	* @brief Runs tasks as _worker, for a thread of the ThreadPool.
+	*/
+	void Help(unsigned int _worker)
+	{
+		Work(_worker);
+
+		lock_guard<mutex> guard(lock);
+		helping--;
+		helped.notify_all();
+	}
+};
+
+/**
+* @brief Threads shared by every WorkStealing run, started on first use and kept for the whole program: one per core, but the caller's.
+*/
+class ThreadPool
+{
+	mutex				  lock;
+	condition_variable	  offered;
+	vector<WorkStealing*> runs;
+	vector<thread>		  threads;
+	bool				  stopping;
+
+	void Work()
+	{
+		pooled = true;
+
+		unique_lock<mutex> guard(lock);
+		for(;;)
+		{
+			while(!stopping && runs.empty())
+				offered.wait(guard);
+			if(stopping)
+				return;
+
+			//A run with no worker left is done with
+			unsigned int worker = 0;
+			WorkStealing* run = runs.back();
+			if(!run->Join(worker))
+			{
+				runs.pop_back();
+				continue;
+			}
+
+			guard.unlock();
+			run->Help(worker);
+			guard.lock();
+		}
+	}
+
+	ThreadPool()
+		: stopping(false)
+	{
+		for(unsigned int i = 1; i < thread::hardware_concurrency(); i++)
+			threads.push_back(thread(&ThreadPool::Work, this));
+	}
+public:
+	~ThreadPool()
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+		offered.notify_all();
+
+		for(unsigned int i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+	static ThreadPool& Instance()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	/**
+	* @brief Number of threads a run can have at once, counting the caller's.
+	*/
+	unsigned int Size()
+	{
+		return static_cast<unsigned int>(threads.size()) + 1;
+	}
+
+	void Offer(WorkStealing* _run)
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			runs.push_back(_run);
+		}
+		offered.notify_all();
+	}
+	/**
+	* @brief Stops offering _run, so that no other thread joins it.
+	*/
+	void Withdraw(WorkStealing* _run)
+	{
+		lock_guard<mutex> guard(lock);
+		runs.erase(remove(runs.begin(), runs.end(), _run), runs.end());
+	}
+};
+
+void WorkStealing::Run()
+{
+	ThreadPool& pool = ThreadPool::Instance();
+	if(workers.size() > 1)
+		pool.Offer(this);
+
+	bool outer = pooled;
+	pooled = true;
+	Work(0);
+	pooled = outer;
+
+	if(workers.size() > 1)
+	{
+		pool.Withdraw(this);
+
+		//Wait for the threads still running a task
+		unique_lock<mutex> guard(lock);
+		while(helping)
+			helped.wait(guard);
+	}
+}
+
+/**
+* @brief Number of threads to use for a number of tasks. 0 means one per core. There are never more than the ThreadPool has.
+*/
+static unsigned int Threads(unsigned int _threads, unsigned int _tasks)
+{
+	if(!_threads || _threads > ThreadPool::Instance().Size())
+		_threads = ThreadPool::Instance().Size();
+
+	if(_threads > _tasks)
+		_threads = _tasks;
+
+	return _threads ? _threads : 1;
+}
+
+/**
+* @brief Streams of a batch.
+*/
+class BatchInput
+{
+public:
+	virtual ~BatchInput() {}
+	virtual unsigned int Size() = 0;
+	virtual Stream*		 Open(unsigned int _index, Error& _error) = 0;
+	virtual void		 Close(Stream* _s) = 0;
+};
+
+class StreamsInput : public BatchInput
+{
+	const vector<Stream*>& streams;
+public:
+	StreamsInput(const vector<Stream*>& _streams)
+		: streams(_streams)
+	{
+	}
+	virtual unsigned int Size()
+	{
+		return static_cast<unsigned int>(streams.size());
+	}
+	virtual Stream* Open(unsigned int _index, Error&)
+	{
+		return streams[_index];
+	}
+	virtual void Close(Stream*)
+	{
+	}
+};
+
+class BatchWorker : public WorkStealing::Worker
+{
+	Parser*			p;
+	BatchInput&		input;
+	ParseContext	c;
+	vector<Parsed>& parsed;
+	BatchListener*	listener;
+	mutex&			listening;
+	const Limits&	limits;
+public:
+	BatchWorker(Parser* _p, BatchInput& _input, vector<Parsed>& _parsed, BatchListener* _listener, mutex& _listening, const Limits& _limits)
+		: p(_p), input(_input), c(0), parsed(_parsed), listener(_listener), listening(_listening), limits(_limits)
+	{
+	}
+	virtual void Run(unsigned int _task)
+	{
+		Parsed& outcome = parsed[_task];
+
+		Stream* s = input.Open(_task, outcome.error);
+		if(s)
+		{
+			c.Restart(s);
+			c.Limit(limits);
+			outcome.result = ParseInTwoPhases(p, c, outcome.tree, outcome.error);
+			input.Close(s);
+		}
+
+		if(listener)
+		{
+			lock_guard<mutex> guard(listening);
+			listener->Done(outcome);
+		}
+	}
+};
+
+static vector<Parsed> ParseInput(Parser* _p, BatchInput& _input, unsigned int _threads, BatchListener* _listener, const Limits& _limits)
+{
+	vector<Parsed> parsed;
+	for(unsigned int i = 0; i < _input.Size(); i++)
+		parsed.push_back(Parsed(i));
+
+	mutex listening;
+	vector<WorkStealing::Worker*> workers;
+	for(unsigned int i = 0; i < Threads(_threads, _input.Size()); i++)
+		workers.push_back(new BatchWorker(_p, _input, parsed, _listener, listening, _limits));
+
+	WorkStealing pool(workers, _input.Size());
+	pool.Run();
+
+	for(unsigned int i = 0; i < workers.size(); i++)
+		delete workers[i];
+
+	return parsed;
+}
+
+vector<Parsed> ParseBatch(Parser* _p, const vector<Stream*>& _streams, unsigned int _threads, BatchListener* _listener, const Limits& _limits)
+{
+	StreamsInput input(_streams);
+	return ParseInput(_p, input, _threads, _listener, _limits);
+}
+
+Throughput::Throughput()
+	: bytes(0), reading(0), parsing(0), waiting(0), elapsed(0)
+{
+}
+
+static double Seconds(const chrono::steady_clock::time_point& _start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - _start).count();
+}
+
+/**
+* @brief Files of a batch, read in order into buffers recycled from a file to the next. There is no thread of its own to read them:
+* a worker which takes a file reads first as many as there is room for, unless another worker is reading, while the others parse.
+* Bytes read and not yet parsed are bounded, though a file bigger than the bound is read once nothing else is in flight.
+*/
+class ReadAhead
+{
+public:
+	struct File
+	{
+		unsigned int  index;
+		vector<char>* buffer; //!< 0 if the file could not be read
 
-		delete _tree;
-		_tree = 0;
+		File(unsigned int _index = 0, vector<char>* _buffer = 0)
+			: index(_index), buffer(_buffer)
+		{
+		}
+	};
 
-		_s->Goto(start);
-		
-		return present ? r : !r;
-	}
-};
+	static const size_t	  RECYCLED = 4 * 1024 * 1024; //!< Capacity above which a buffer is freed when recycled.
 
+private:
+	const vector<string>& files;
+	size_t				  bound;
 
-static STNode* Colapse(STNode* _node)
-{
-	if(_node->IsLeaf())
+	mutex				  lock;
+	condition_variable	  changed;
+	deque<File>			  ready;
+	vector<vector<char>*> recycled;
+	size_t				  inFlight;
+	unsigned int		  next;	   //!< File to read next.
+	bool				  reading; //!< Whether a worker is reading.
+	bool				  full;	   //!< Whether there was no room for the next file, since a buffer was last released.
+	Throughput&			  throughput;
+
+	//Of the next file, only read by the worker reading
+	bool				  sized;
+	FILE*				  opened;
+	size_t				  size;
+
+	static bool ReadFile(FILE* _f, size_t _size, vector<char>& _buffer)
 	{
-		delete _node;
-		return 0;
+		_buffer.resize(_size);
+		return fread(_buffer.data(), 1, _size, _f) == _size;
 	}
-	else if(_node->Sons() == 1)
+
+	/**
+	* @brief Keeps a buffer for the next files. One bigger than RECYCLED is freed first, so that a big file doesn't keep its memory
+	* for the rest of the batch. Called with the lock taken.
+	*/
+	void Recycle(vector<char>* _buffer)
 	{
-		STNode* son = _node->Son(0);
-		_node->UnlinkAll();
-		delete _node;
-		_node = son;
+		if(_buffer->capacity() > RECYCLED)
+			vector<char>().swap(*_buffer);
+		recycled.push_back(_buffer);
 	}
 
-	return _node;
-}
+	/**
+	* @brief Reads the next file, if there is room for it. Called by the worker reading, without the lock.
+	* @return Whether it has been read, or found unreadable.
+	*/
+	bool ReadNext()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if(!sized)
+		{
+			opened = 0;
+			size = 0;
+			fopen_s(&opened, files[next].c_str(), "rb");
+			if(opened && !fseek(opened, 0, SEEK_END))
+			{
+				size = (size_t)ftell(opened);
+				if(fseek(opened, 0, SEEK_SET))
+				{
+					fclose(opened);
+					opened = 0;
+				}
+			}
+			sized = true;
+		}
 
-class RepeatParser : public Parser
-{
-	Parser* p;
-	int minN;
-	int maxN;
+		vector<char>* buffer = 0;
+		{
+			lock_guard<mutex> guard(lock);
+			throughput.reading += Seconds(start);
+			if(inFlight && inFlight + size > bound)
+			{
+				full = true;
+				return false;
+			}
 
-public:
-	RepeatParser(Parser* _p, int _minN, int _maxN)
-		: p(_p), minN(_minN), maxN(_maxN)
-	{
+			inFlight += size;
+			if(recycled.empty())
+			{
+				buffer = new vector<char>();
+			}
+			else
+			{
+				buffer = recycled.back();
+				recycled.pop_back();
+			}
+		}
+
+		start = chrono::steady_clock::now();
+		bool read = opened && ReadFile(opened, size, *buffer);
+		if(opened)
+			fclose(opened);
+		opened = 0;
+		sized = false;
+
+		{
+			lock_guard<mutex> guard(lock);
+			throughput.reading += Seconds(start);
+			if(read)
+				throughput.bytes += size;
+
+			File file(next++, buffer);
+			if(!read)
+			{
+				inFlight -= size;
+				Recycle(buffer);
+				file.buffer = 0;
+			}
+			ready.push_back(file);
+		}
+		changed.notify_all();
+		return true;
 	}
-	virtual ~RepeatParser()
+public:
+	ReadAhead(const vector<string>& _files, size_t _bound, Throughput& _throughput)
+		: files(_files), bound(_bound), inFlight(0), next(0), reading(false), full(false), throughput(_throughput),
+		  sized(false), opened(0), size(0)
 	{
-		delete p;
 	}
-	virtual void Reset()
+	~ReadAhead()
 	{
-		p->Reset();
+		if(opened)
+			fclose(opened);
+
+		for(unsigned int i = 0; i < recycled.size(); i++)
+			delete recycled[i];
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	/**
+	* @brief Takes the next file read, reading files first if no other worker is and there is room for them.
+	* @param _waiting [in, out] Seconds waited for other workers to read or to release buffers are added to it.
+	* @return False once every file has been taken.
+	*/
+	bool Take(File& _file, double& _waiting)
 	{
-		_tree = 0;
-		Position start = _s->Where();
-
-		STNode* repetition = new STNode(_s->Where());
-		Error e;
-
-		//Mandatory part
-		int i = 0;
-		for(; i < minN; i++)
+		unique_lock<mutex> guard(lock);
+		for(;;)
 		{
-			STNode* t = 0;
-			Result r = p->Parse(_s, t);
-			e += r.fail;
-			if(!r)
+			if(!reading && !full && next < files.size())
 			{
-				_s->Goto(start);
-				delete repetition;
-				return Failure(e);
+				reading = true;
+				guard.unlock();
+				while(next < files.size() && ReadNext())
+					;
+				guard.lock();
+				reading = false;
+				changed.notify_all();
 			}
 
-			repetition->AddSon(t);
+			if(!ready.empty())
+			{
+				_file = ready.front();
+				ready.pop_front();
+				return true;
+			}
+			if(next >= files.size() && !reading)
+				return false;
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			changed.wait(guard);
+			_waiting += Seconds(start);
 		}
+	}
+	/**
+	* @brief Gives back the buffer of a file already parsed.
+	*/
+	void Release(const File& _file)
+	{
+		if(!_file.buffer)
+			return;
 
-		//Optional part
-		for(; (i < maxN) || (maxN == -1); i++)
 		{
-			STNode* t = 0;
-			Result r = p->Parse(_s, t);
-			e += r.fail;
-			if(!r)
-				break;
-			repetition->AddSon(t);
+			lock_guard<mutex> guard(lock);
+			inFlight -= _file.buffer->size();
+			Recycle(_file.buffer);
+			full = false;
 		}
-
-		_tree = Colapse(repetition);
-		return Success(e);
+		changed.notify_all();
 	}
 };
 
-class SequenceParser : public Parser
+/**
+* @brief Parses the files of a batch as they are read, until there are no more, reading them itself when it is its turn.
+*/
+class FileWorker : public WorkStealing::Worker
 {
-	vector<Parser*> ps;
+	Parser*			p;
+	ReadAhead&		files;
+	const vector<string>& names;
+	ParseContext	c;
+	vector<Parsed>& parsed;
+	BatchListener*	listener;
+	mutex&			listening;
+	const Limits&	limits;
 public:
-	SequenceParser(const vector<Parser*> _ps)
-		: ps(_ps)
+	double			parsing;
+	double			waiting;
+
+	FileWorker(Parser* _p, ReadAhead& _files, const vector<string>& _names, vector<Parsed>& _parsed, BatchListener* _listener, mutex& _listening,
+			   const Limits& _limits)
+		: p(_p), files(_files), names(_names), c(0), parsed(_parsed), listener(_listener), listening(_listening), limits(_limits),
+		  parsing(0), waiting(0)
 	{
 	}
-	virtual ~SequenceParser()
+	virtual void Run(unsigned int)
 	{
-		for(unsigned int i = 0; i < ps.size(); i++)
-			delete ps[i];
+		for(;;)
+		{
+			ReadAhead::File file;
+			if(!files.Take(file, waiting))
+				return;
+
+			Parsed& outcome = parsed[file.index];
+			if(file.buffer)
+			{
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				StreamImpl s(file.buffer->data(), file.buffer->size(), false);
+				c.Restart(&s);
+				c.Limit(limits);
+				outcome.result = ParseInTwoPhases(p, c, outcome.tree, outcome.error);
+				parsing += Seconds(start);
+			}
+			else
+			{
+				outcome.error = Error(names[file.index] + " could not be open");
+			}
+			files.Release(file);
+
+			if(listener)
+			{
+				lock_guard<mutex> guard(listening);
+				listener->Done(outcome);
+			}
+		}
 	}
-	virtual void Reset()
+};
+
+vector<Parsed> ParseFiles(Parser* _p, const vector<string>& _files, unsigned int _threads, BatchListener* _listener, size_t _readAhead, Throughput* _throughput,
+						  const Limits& _limits)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	vector<Parsed> parsed;
+	for(unsigned int i = 0; i < _files.size(); i++)
+		parsed.push_back(Parsed(i));
+
+	Throughput throughput;
 	{
-		for(unsigned int i = 0; i < ps.size(); i++)
-			ps[i]->Reset();
+		ReadAhead files(_files, _readAhead, throughput);
+
+		//Each worker is a task, which goes on until every file is taken
+		mutex listening;
+		vector<WorkStealing::Worker*> workers;
+		for(unsigned int i = 0; i < Threads(_threads, static_cast<unsigned int>(_files.size())); i++)
+			workers.push_back(new FileWorker(_p, files, _files, parsed, _listener, listening, _limits));
+
+		WorkStealing pool(workers, static_cast<unsigned int>(workers.size()));
+		pool.Run();
+
+		for(unsigned int i = 0; i < workers.size(); i++)
+		{
+			FileWorker* worker = static_cast<FileWorker*>(workers[i]);
+			throughput.parsing += worker->parsing;
+			throughput.waiting += worker->waiting;
+			delete worker;
+		}
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
-	{
-		_tree = 0;
-		Position start = _s->Where();
+	throughput.elapsed = Seconds(start);
 
-		STNode* sequence = new STNode(_s->Where());
-		Error e;
+	if(_throughput)
+		*_throughput = throughput;
+	return parsed;
+}
 
-		for(unsigned int i = 0; i < ps.size(); i++)
+/**
+* @brief Lines of a buffer, each one read in place by a stream whose positions are those of the line in the buffer.
+*/
+class RecordsInput : public BatchInput
+{
+	struct Record
+	{
+		const char*	 first;
+		size_t		 size;
+		unsigned int row;
+	};
+
+	vector<Record> records;
+public:
+	RecordsInput(const char* _first, const char* _last)
+	{
+		unsigned int row = 1;
+		for(const char* line = _first; line < _last; row++)
 		{
-			Parser* p = ps[i];
-			STNode* t = 0;
-			Result r = p->Parse(_s, t);
-			e += r.fail;			
-			if(!r)
-			{
-				_s->Goto(start);
-				delete sequence;
-				return Failure(e);
-			}
+			const char* end = static_cast<const char*>(memchr(line, '\n', _last - line));
+			if(!end)
+				end = _last;
 
-			sequence->AddSon(t);
-		}
+			Record record = {line, static_cast<size_t>(end - line), row};
+			if(record.size && line[record.size - 1] == '\r')
+				record.size--;
+			if(record.size)
+				records.push_back(record);
 
-		_tree = Colapse(sequence);
-		return Success(e);
+			line = end + 1;
+		}
+	}
+	virtual unsigned int Size()
+	{
+		return static_cast<unsigned int>(records.size());
+	}
+	virtual Stream* Open(unsigned int _index, Error&)
+	{
+		const Record& record = records[_index];
+		return new StreamImpl(record.first, record.size, false, Position(record.row, 1));
+	}
+	virtual void Close(Stream* _s)
+	{
+		delete _s;
 	}
 };
 
-class ChoiceParser : public Parser
+vector<Parsed> ParseRecords(Parser* _p, const char* _first, const char* _last, unsigned int _threads, BatchListener* _listener, const Limits& _limits)
 {
-	vector<Parser*> ps;
-public:
-	ChoiceParser(const vector<Parser*> _ps)
-		: ps(_ps)
+	RecordsInput input(_first, _last);
+	return ParseInput(_p, input, _threads, _listener, _limits);
+}
+
+vector<Parsed> ParseRecordFile(Parser* _p, const char* _fileName, unsigned int _threads, BatchListener* _listener, const Limits& _limits)
+{
+	MappedFile file(_fileName);
+	if(!file.Data())
 	{
+		vector<Parsed> parsed(1);
+		parsed[0].error = Error(string(_fileName) + " could not be open");
+		return parsed;
 	}
-	virtual ~ChoiceParser()
+
+	return ParseRecords(_p, file.Data(), file.Data() + file.Size(), _threads, _listener, _limits);
+}
+
+
+
+//Parallel parsers
+Splitter::Splitter(char _terminator, const string& _nesting, const string& _quotes, char _comment)
+	: terminator(_terminator), nesting(_nesting), quotes(_quotes), comment(_comment)
+{
+}
+
+/**
+* @brief Follows, char by char, the nesting, literals and comments of a text, as a Splitter tells.
+*/
+class SplitScan
+{
+	const Splitter& splitter;
+	int				depth;
+	char			quote;
+	bool			commented;
+public:
+	enum Char
 	{
-		for(unsigned int i = 0; i < ps.size(); i++)
-			delete ps[i];
-	}
-	virtual void Reset()
+		INNER,		//!< Inside a nesting, literal or comment, or not relevant
+		TERMINATOR, //!< The terminator, out of any nesting
+		CLOSER		//!< Closes the outermost nesting
+	};
+
+	SplitScan(const Splitter& _splitter)
+		: splitter(_splitter), depth(0), quote(0), commented(false)
 	{
-		for(unsigned int i = 0; i < ps.size(); i++)
-			ps[i]->Reset();
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	Char Next(char _c)
 	{
-		_tree = 0;
-		Error e;
-		
-		for(unsigned int i = 0; i < ps.size(); i++)
+		if(commented)
 		{
-			Parser* p = ps[i];
-			STNode* t= 0;
-			Result r = p->Parse(_s, t);
-			e += r.fail;
-			if(r)
-			{
-				_tree = t;
-				return r;
-			}
+			commented = (_c != '\n');
 		}
-		
-		return Failure(e);
+		else if(quote)
+		{
+			quote = (_c == quote) ? 0 : quote;
+		}
+		else if(splitter.comment && _c == splitter.comment)
+		{
+			commented = true;
+		}
+		else if(splitter.quotes.find(_c) != string::npos)
+		{
+			quote = _c;
+		}
+		else if(splitter.nesting.find(_c) != string::npos)
+		{
+			bool closes = (splitter.nesting.find(_c) % 2) != 0;
+			depth += closes ? -1 : 1;
+			if(closes && !depth)
+				return CLOSER;
+		}
+		else if(_c == splitter.terminator && !depth)
+		{
+			return TERMINATOR;
+		}
+
+		return INNER;
 	}
 };
 
-
-class ReferenceParser : public Parser
+/**
+* @brief Items of a repetition parsed from a chunk of the input.
+*/
+struct Chunk
 {
-	Parser** p;
-public:
-	ReferenceParser(Parser** _p)
-		: p(_p)
+	size_t			first;	 //!< Offset of the chunk in the input
+	Position		where;	 //!< Position of its first char
+	Position		end;	 //!< Where its items must end. In the last chunk, where they end.
+	vector<STNode*> items;
+	bool			matched; //!< Whether its items end at end
+
+	Chunk(size_t _first, const Position& _where)
+		: first(_first), where(_where), matched(false)
 	{
 	}
-	virtual void Reset()
+};
+
+/**
+* @brief Parses items from the beginning of each chunk, on a stream reaching the end of the input, so that they are the same a sequential
+* parse would find. Items of a chunk matches if they end exactly where the next chunk begins.
+*/
+class ChunkWorker : public WorkStealing::Worker
+{
+	Parser*				p;
+	const char*			input;
+	size_t				size;
+	vector<Chunk>&		chunks;
+	const ParseContext& outer;
+	ParseContext		c;
+public:
+	ChunkWorker(Parser* _p, const char* _input, size_t _size, vector<Chunk>& _chunks, const ParseContext& _outer)
+		: p(_p), input(_input), size(_size), chunks(_chunks), outer(_outer), c(0, false)
 	{
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	virtual void Run(unsigned int _task)
 	{
-		return (*p)->Parse(_s, _tree);
+		Chunk& chunk = chunks[_task];
+		bool last = (_task + 1 == chunks.size());
+
+		StreamImpl s(input + chunk.first, size - chunk.first, false, chunk.where);
+		c.Restart(&s, false);
+		c.Inherit(outer);
+
+		for(;;)
+		{
+			Position before = s.Where();
+
+			STNode* t = 0;
+			Result r = p->Parse(c, t);
+			if(r.aborted)
+				return;
+			if(!r)
+				break;
+			chunk.items.push_back(t);
+
+			//An empty item would repeat forever. Let the sequential parse deal with it.
+			Position after = s.Where();
+			if(after == before)
+				return;
+
+			if(!last && !(after < chunk.end))
+			{
+				chunk.matched = (after == chunk.end);
+				return;
+			}
+		}
+
+		if(last)
+		{
+			chunk.end	  = s.Where();
+			chunk.matched = true;
+		}
 	}
 };
 
-class TokenParser : public Parser
+static const size_t MIN_CHUNK = 16384; //!< Smaller chunks are not worth a thread
+
+class ParallelParser : public Parser
 {
-	Parser* p;
+	Parser*	 p;
+	int		 minN;
+	Splitter splitter;
+
+	/**
+	* @brief Splits _input, which starts at _start, after terminators in chunks of at least _chunk chars.
+	*/
+	void Split(const char* _input, size_t _size, const Position& _start, size_t _chunk, vector<Chunk>& _chunks)
+	{
+		_chunks.push_back(Chunk(0, _start));
 
-	class Stringifier : public TreeVisitor
+		Position where = _start;
+		SplitScan scan(splitter);
+		for(size_t i = 0; i < _size; i++)
+		{
+			char c = _input[i];
+			bool split = scan.Next(c) == SplitScan::TERMINATOR && (i + 1 - _chunks.back().first >= _chunk);
+
+			if(c == '\n')
+			{
+				where.row++;
+				where.column = 1;
+			}
+			else
+			{
+				where.column++;
+			}
+
+			if(split)
+			{
+				_chunks.back().end = where;
+				_chunks.push_back(Chunk(i + 1, where));
+			}
+		}
+	}
+
+	Result Sequential(ParseContext& _c, STNode* _repetition, int _n, const Position& _start, ErrorHandle _e)
 	{
-		string result;
-	public:
-		bool Visit(STNode* _node, unsigned int _level)
+		Stream* _s = _c.Input();
+
+		for(;; _n++)
 		{
-			if(!_node->childs.size())
-				result += _node->data;
+			if(_c.Abort())
+			{
+				_s->Goto(_start);
+				delete _repetition;
+				return Aborted();
+			}
 
-			return true;
+			STNode* t = 0;
+			Result r = p->Parse(_c, t);
+			_e = _c.Merge(_e, r.error);
+			if(r.aborted)
+			{
+				_s->Goto(_start);
+				delete _repetition;
+				return r;
+			}
+			if(!r)
+				break;
+			_repetition->AddSon(t);
 		}
-		string GetResult()
+
+		if(_n < minN)
 		{
-			return result;
+			_s->Goto(_start);
+			delete _repetition;
+			return Failure(_e);
 		}
-	};
+
+		return Success(_e);
+	}
 
 public:
-	TokenParser(Parser* _p)
-		: p(_p)
+	ParallelParser(Parser* _p, int _minN, const Splitter& _splitter)
+		: p(_p), minN(_minN), splitter(_splitter)
 	{
 	}
-	virtual ~TokenParser()
+	virtual ~ParallelParser()
 	{
 		delete p;
 	}
-	virtual void Reset()
-	{
-		p->Reset();
-	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
 	{
+		Stream* _s = _c.Input();
+		_tree = 0;
 		Position start = _s->Where();
-		Result r = p->Parse(_s, _tree);
-		if(r && _tree)
+
+		STNode* repetition = new STNode(start);
+
+		//Errors are only tracked by a sequential parse, and a thread already running tasks of a pool goes on alone
+		const char* input = 0;
+		size_t size = 0;
+		vector<Chunk> chunks;
+		unsigned int threads = ThreadPool::Instance().Size();
+		if(!_c.Diagnoses() && !_c.Recovers() && !_c.Tracked() && !pooled && threads > 1)
+			input = _s->Rest(size);
+		if(input)
 		{
-			Stringifier s;
-			PreWalk(_tree, &s);
-			delete _tree;
-			_tree = new STNode(start, s.GetResult());
-			return Success();
+			//A few chunks per thread, to balance the load
+			Split(input, size, start, max(MIN_CHUNK, size / (threads * 4)), chunks);
+		}
+
+		if(chunks.size() < 2)
+		{
+			Result r = Sequential(_c, repetition, 0, start, 0);
+			if(r)
+				_tree = Colapse(repetition);
+			return r;
+		}
+
+		vector<WorkStealing::Worker*> workers;
+		for(unsigned int i = 0; i < Threads(threads, static_cast<unsigned int>(chunks.size())); i++)
+			workers.push_back(new ChunkWorker(p, input, size, chunks, _c));
+
+		WorkStealing pool(workers, static_cast<unsigned int>(chunks.size()));
+		pool.Run();
+
+		for(unsigned int i = 0; i < workers.size(); i++)
+			delete workers[i];
+
+		//Keep the chunks up to the first one that doesn't match, and parse sequentially from there
+		int n = 0;
+		unsigned int k = 0;
+		for(; k < chunks.size() && chunks[k].matched; k++)
+		{
+			for(unsigned int i = 0; i < chunks[k].items.size(); i++)
+				repetition->AddSon(chunks[k].items[i]);
+			n += static_cast<int>(chunks[k].items.size());
+		}
+		for(unsigned int i = k; i < chunks.size(); i++)
+		{
+			for(unsigned int j = 0; j < chunks[i].items.size(); j++)
+				delete chunks[i].items[j];
+		}
+
+		Result r = Success();
+		if(k < chunks.size())
+		{
+			_s->Goto(chunks[k].where);
+			r = Sequential(_c, repetition, n, start, 0);
+		}
+		else
+		{
+			_s->Goto(chunks.back().end);
+			if(n < minN)
+			{
+				_s->Goto(start);
+				delete repetition;
+				r = Failure(0);
+			}
 		}
+
+		if(r)
+			_tree = Colapse(repetition);
 		return r;
 	}
+	virtual Parser* Optimized(Optimizer& _optimizer)
+	{
+		p = _optimizer.Optimize(p);
+		return this;
+	}
 };
 
-class IgnoreParser : public Parser
+Parser* Parallel(int _minN, const Splitter& _splitter, Parser* _p) {return new MemoryParser(new ParallelParser(_p, _minN, _splitter));}
+
+
+/**
+* @brief Outcome of an alternative of a ParallelChoice.
+*/
+struct Alternative
 {
-	Parser* p;
+	atomic<bool> cancel; //!< Set once an alternative before this one has succeeded
+	Result		 result;
+	STNode*		 tree;
+	Position	 end;	 //!< Where the input is left on success
+
+	Alternative()
+		: cancel(false), tree(0)
+	{
+	}
+};
 
+/**
+* @brief Parses alternatives from the same point, each with a context of its own, so with memo tables of its own.
+* Once one succeeds, the alternatives after it are cancelled.
+*/
+class AlternativeWorker : public WorkStealing::Worker
+{
+	const vector<Parser*>& ps;
+	const char*			   input;
+	size_t				   size;
+	Position			   start;
+	vector<Alternative>&   alternatives;
+	const ParseContext&	   outer;
+	ParseContext		   c;
 public:
-	IgnoreParser(Parser* _p)
-		: p(_p)
+	AlternativeWorker(const vector<Parser*>& _ps, const char* _input, size_t _size, const Position& _start, vector<Alternative>& _alternatives,
+					  const ParseContext& _outer)
+		: ps(_ps), input(_input), size(_size), start(_start), alternatives(_alternatives), outer(_outer), c(0, false)
 	{
 	}
-	virtual ~IgnoreParser()
+	virtual void Run(unsigned int _task)
 	{
-		delete p;
+		Alternative& alternative = alternatives[_task];
+		if(alternative.cancel.load())
+			return;
+
+		StreamImpl s(input, size, false, start);
+		c.Restart(&s, false);
+		c.Inherit(outer);
+		c.Cancellation(&alternative.cancel);
+
+		alternative.result = ps[_task]->Parse(c, alternative.tree);
+		if(alternative.result)
+		{
+			alternative.end = s.Where();
+			for(unsigned int i = _task + 1; i < alternatives.size(); i++)
+				alternatives[i].cancel.store(true);
+		}
 	}
-	virtual void Reset()
+};
+
+class ParallelChoiceParser : public ChoiceParser
+{
+public:
+	ParallelChoiceParser(const vector<Parser*> _ps)
+		: ChoiceParser(_ps)
 	{
-		p->Reset();
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
 	{
-		Result r = p->Parse(_s, _tree);
-		delete _tree;
+		//Errors are only tracked by a sequential parse, and a thread already running tasks of a pool goes on alone
+		Stream* _s = _c.Input();
+		size_t size = 0;
+		const char* input = 0;
+		unsigned int threads = Threads(0, static_cast<unsigned int>(ps.size()));
+		if(!_c.Diagnoses() && !_c.Recovers() && !_c.Tracked() && !pooled && threads > 1)
+			input = _s->Rest(size);
+		if(!input)
+			return ChoiceParser::Parse(_c, _tree);
+
+		if(_c.Abort())
+			return Aborted();
+
 		_tree = 0;
+		Position start = _s->Where();
+
+		vector<Alternative> alternatives(ps.size());
+		vector<WorkStealing::Worker*> workers;
+		for(unsigned int i = 0; i < threads; i++)
+			workers.push_back(new AlternativeWorker(ps, input, size, start, alternatives, _c));
+
+		WorkStealing pool(workers, static_cast<unsigned int>(ps.size()));
+		pool.Run();
+
+		for(unsigned int i = 0; i < workers.size(); i++)
+			delete workers[i];
+
+		//The first alternative that succeeded wins, as in a sequential parse, unless one before it was stopped by the limits
+		Result r = Failure(0);
+		for(unsigned int i = 0; i < alternatives.size(); i++)
+		{
+			if(!r && !r.aborted && alternatives[i].result)
+			{
+				_s->Goto(alternatives[i].end);
+				_tree = alternatives[i].tree;
+				r = Success();
+			}
+			else
+			{
+				if(!r && alternatives[i].result.aborted)
+					r = Aborted();
+				delete alternatives[i].tree;
+			}
+		}
+
 		return r;
 	}
+	virtual string Signature(Optimizer& _optimizer)
+	{
+		return "Parallel" + ChoiceParser::Signature(_optimizer);
+	}
 };
 
-class ClearParser : public Parser
+Parser* ParallelChoice(unsigned int _number, ...)
 {
-	Parser* p;
+	va_list arguments;                     
+	vector<Parser*> ps;
 
-public:
-	ClearParser(Parser* _p)
-		: p(_p)
+	va_start(arguments, _number);           
+	for(unsigned int i = 0; i < _number; i++)
 	{
+		ps.push_back(va_arg(arguments, Parser*)); 
 	}
-	virtual ~ClearParser()
+	va_end(arguments);
+
+	return new MemoryParser(new ParallelChoiceParser(ps));
+}
+
+
+//Pre-lexing
+/**
+* @brief Ends of line of an input, to find the position of any offset.
+*/
+class Lines
+{
+	Position	   start;
+	vector<size_t> ends;
+public:
+	Lines(const char* _input, size_t _size, const Position& _start)
+		: start(_start)
 	{
-		delete p;
+		const char* first = _input;
+		const char* last = first + _size;
+		for(const char* end = first; (end = static_cast<const char*>(memchr(end, '\n', last - end))) != 0; end++)
+			ends.push_back(end - first);
 	}
-	virtual void Reset()
+	const vector<size_t>& Ends() const
 	{
-		p->Reset();
+		return ends;
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	Position At(size_t _offset) const
 	{
-		return p->Parse(_s, _tree).Clear();
+		size_t row = lower_bound(ends.begin(), ends.end(), _offset) - ends.begin();
+		if(!row)
+			return Position(start.row, start.column + static_cast<unsigned int>(_offset));
+
+		return Position(start.row + static_cast<unsigned int>(row), static_cast<unsigned int>(_offset - ends[row - 1]));
 	}
 };
 
-class MemoryParser : public Parser
+/**
+* @brief Lexes an input from any offset, taking it as a token boundary, within the limits of the parse which lexes it.
+*/
+class Lexer
 {
-	class Memorizer
+	Parser*					ignore;
+	const vector<Parser*>&	tokens;
+	const char*				input;
+	size_t					size;
+	const Lines&			lines;
+	const ParseContext&		outer;
+	ParseContext			c;
+	unsigned long long		spent; //!< Steps taken by all its runs.
+
+	size_t Step(StreamImpl& _s, size_t _base, TokenTable& _table)
 	{
-		struct Memorization  
-		{
-			Result result;
-			Position newPosition;
-			STNode* tree;
+		TokenTable::Lexeme lexeme;
+		lexeme.cursor = _base + _s.Offset();
 
-			Memorization(const Result& _r, const Position& _p, STNode* _tree)
-				: result(_r), newPosition(_p), tree(_tree)
-			{}
-		};
+		STNode* t = 0;
+		if(ignore->Parse(c, t).aborted)
+		{
+			delete t;
+			return _base + _s.Offset();
+		}
+		delete t;
 
-		map<Position, Memorization> memory;
+		lexeme.first = _base + _s.Offset();
+		lexeme.where = _s.Where();
+		_table.lexemes.push_back(lexeme);
 
-		STNode* Copy(STNode* _node)
+		size_t next = lexeme.first + 1;
+		for(unsigned int i = 0; i < tokens.size(); i++)
 		{
-			if(!_node)
-				return 0;
+			_s.Goto(lexeme.where);
 
-			STNode* newNode = new STNode(_node->where, _node->data);
-			for(unsigned int i = 0; i < _node->Sons(); i++)
-				newNode->AddSon(Copy(_node->Son(i)));
-			return newNode;
-		}
-	public:
-		void Reset()
-		{
-			//Must walk deleting trees as they're copied
-			for(map<Position, Memorization>::iterator i = memory.begin(); i != memory.end(); i++)
+			TokenTable::Match match;
+			match.length = -1;
+			match.node = false;
+
+			t = 0;
+			Result r = tokens[i]->Parse(c, t);
+			if(r.aborted)
 			{
-				delete i->second.tree;
+				delete t;
+				_table.lexemes.pop_back();
+				_table.matches.resize(_table.lexemes.size() * tokens.size());
+				return lexeme.cursor;
 			}
-
-			memory.clear();
-		}
-		bool IsKnown(const Position& _position)
-		{
-			return (memory.find(_position) != memory.end());
-		}
-		bool Remember(const Position& _position, Result& _result, Position& _newPosition, STNode*& _tree)
-		{
-			map<Position, Memorization>::iterator i = memory.find(_position);
-			if (i == memory.end())
-				return false;
-
-			_result      = i->second.result;
-			_newPosition = i->second.newPosition;
-			_tree        = Copy(i->second.tree);
-			return true;
-		}
-		void Memorize(const Position& _position, const Result& _result, const Position& _newPosition, STNode* _tree)
-		{
-			map<Position, Memorization>::iterator i = memory.find(_position);
-			if (i == memory.end())
+			if(r)
 			{
-				memory.insert(pair<Position, Memorization>(_position, Memorization(_result, _newPosition, Copy(_tree))));
+				match.length = static_cast<int>(_base + _s.Offset() - lexeme.first);
+				match.node = (t != 0);
+				if(t)
+					match.data = t->data;
+				next = max(next, _base + _s.Offset());
 			}
+			delete t;
+
+			_table.matches.push_back(match);
 		}
-	};
 
-	Memorizer memory;
-	Parser* p;
+		_s.Goto(lexeme.where);
+		while(_base + _s.Offset() < next && !_s.AtEnd())
+			_s.Next();
+
+		return next;
+	}
 public:
-	MemoryParser(Parser* _p)
-		: p(_p)
+	Lexer(Parser* _ignore, const vector<Parser*>& _tokens, const char* _input, size_t _size, const Lines& _lines, const ParseContext& _outer)
+		: ignore(_ignore), tokens(_tokens), input(_input), size(_size), lines(_lines), outer(_outer), c(0, false), spent(0)
 	{
 	}
-	virtual ~MemoryParser()
+	bool Aborted()
 	{
-		delete p;
+		return c.Stopped();
 	}
-	virtual void Reset()
+	unsigned long long Spent()
 	{
-		memory.Reset();
-		p->Reset();
+		return spent;
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	/**
+	* @brief Lexes from _cursor while before _stop, adding the lexemes to _table.
+	* @param _budget [in]  Steps it can take, or 0 to take the limits of the outer parse only.
+	* @param _join   [in]  Optional. Lexing stops as soon as it reaches a cursor from which _join was lexed, as it would find the same.
+	* @param _joined [out] Index of that lexeme in _join, or -1 if not reached.
+	* @return Cursor where lexing stopped, which is before _stop if aborted by the limits.
+	*/
+	size_t Run(size_t _cursor, size_t _stop, TokenTable& _table, unsigned long long _budget, const TokenTable* _join = 0, size_t* _joined = 0)
 	{
-		if(memory.IsKnown(_s->Where()))
+		StreamImpl s(input + _cursor, size - _cursor, false, lines.At(_cursor));
+		c.Restart(&s, false);
+		c.Inherit(outer);
+		if(_budget)
+			c.Budget(_budget);
+
+		size_t base = _cursor;
+		while(_cursor < _stop && !c.Stopped())
 		{
-			Result r;
-			Position n;
-			
-			memory.Remember(_s->Where(), r, n, _tree);
+			if(_join && (*_joined = _join->Lexed(_cursor)) != static_cast<size_t>(-1))
+				break;
 
-			if(n != _s->Where())
-				_s->Goto(n);
-			
-			return r;
+			_cursor = Step(s, base, _table);
 		}
-		
-		Position start = _s->Where();
-
-		Result r = p->Parse(_s, _tree);
 
-		memory.Memorize(start, r, _s->Where(), _tree);
-
-		return r;
+		spent += c.Steps();
+		return _cursor;
 	}
 };
 
-
-
-Parser* Char(const Set& _set)		{return new CharParser(_set);}
-Parser* Word(const string& _word)	{return new MemoryParser(new WordParser(_word));}
-Parser* Empty()						{return new EmptyParser();}
-Parser* Any()						{return new AnyParser();}
-Parser* EndOfInput()				{return new EndOfInputParser();}
-
-Parser* At		(Parser* _p)						{return new MemoryParser(new CheckParser(_p, true));}
-Parser* NotAt	(Parser* _p)						{return new MemoryParser(new CheckParser(_p, false));}
-Parser* Optional(Parser* _p)						{return new MemoryParser(new RepeatParser(_p, 0, 1));}
-Parser* Star	(Parser* _p)						{return new MemoryParser(new RepeatParser(_p, 0, -1));}
-Parser* Plus	(Parser* _p)						{return new MemoryParser(new RepeatParser(_p, 1, -1));}
-Parser* Repeat	(int _minN, int _maxN, Parser* _p)	{return new MemoryParser(new RepeatParser(_p, _minN, _maxN));}
-Parser* Sequence(unsigned int _number, ...)
+class LexWorker : public WorkStealing::Worker
 {
-	va_list arguments;                     
-	vector<Parser*> ps;
-
-	va_start(arguments, _number);           
-	for(unsigned int i = 0; i < _number; i++)
+	Lexer								lexer;
+	const vector<size_t>&				firsts;
+	const vector<unsigned long long>&	budgets;
+	vector<TokenTable*>&				tables;
+	vector<size_t>&						ends;
+public:
+	LexWorker(Parser* _ignore, const vector<Parser*>& _tokens, const char* _input, size_t _size, const Lines& _lines, const ParseContext& _outer,
+			  const vector<size_t>& _firsts, const vector<unsigned long long>& _budgets, vector<TokenTable*>& _tables, vector<size_t>& _ends)
+		: lexer(_ignore, _tokens, _input, _size, _lines, _outer), firsts(_firsts), budgets(_budgets), tables(_tables), ends(_ends)
 	{
-		ps.push_back(va_arg(arguments, Parser*)); 
 	}
-	va_end(arguments);
-
-	return new MemoryParser(new SequenceParser(ps));
-}
-Parser* Choice	(unsigned int _number, ...)
-{
-	va_list arguments;                     
-	vector<Parser*> ps;
-
-	va_start(arguments, _number);           
-	for(unsigned int i = 0; i < _number; i++)
+	unsigned long long Spent()
 	{
-		ps.push_back(va_arg(arguments, Parser*)); 
+		return lexer.Spent();
 	}
-	va_end(arguments);
+	virtual void Run(unsigned int _task)
+	{
+		ends[_task] = lexer.Run(firsts[_task], firsts[_task + 1], *tables[_task], budgets[_task]);
+	}
+};
 
-	return new MemoryParser(new ChoiceParser(ps));
-}
+void ParseContext::Lex(Parser* _ignore, const vector<Parser*>& _tokens, unsigned int _threads)
+{
+	delete tokens;
+	tokens = 0;
 
-Parser* Reference	(Parser** _p)	{return new ReferenceParser(_p);}
-Parser* Token		(Parser* _p)	{return new TokenParser(_p);}
-Parser* Ignore		(Parser* _p)	{return new IgnoreParser(_p);}
-Parser* Clear		(Parser* _p)	{return new ClearParser(_p);}
+	if(diagnose || recover || tracked || _tokens.empty())
+		return;
 
+	//Only an input held in memory is lexed, in place
+	size_t size = 0;
+	const char* input = this->input->Rest(size);
+	if(!input)
+		return;
+	Lines lines(input, size, this->input->Where());
 
-class NameParser : public Parser
-{
-	Parser* p;
-	string name;
-	bool insert;
-public:
-	NameParser(Parser* _p, const string& _name, bool _insert)
-		: p(_p), name(_name), insert(_insert)
+	//Chunks start at lines, which usually begin with a token. The last one ends after the end of input, where a token may match.
+	vector<size_t> firsts(1, 0);
+	for(unsigned int i = 0; i < lines.Ends().size(); i++)
 	{
+		if(lines.Ends()[i] + 1 - firsts.back() >= MIN_CHUNK)
+			firsts.push_back(lines.Ends()[i] + 1);
 	}
-	virtual ~NameParser()
-	{
-		delete p;
-	}
-	virtual void Reset()
+	firsts.push_back(size + 1);
+
+	unsigned int chunks = static_cast<unsigned int>(firsts.size() - 1);
+	unsigned int kinds = static_cast<unsigned int>(_tokens.size());
+
+	vector<TokenTable*> tables;
+	vector<size_t> ends(chunks);
+	for(unsigned int i = 0; i < chunks; i++)
+		tables.push_back(new TokenTable(kinds));
+
+	//The steps left are shared by the chunks, as their lengths are, so that lexing them at once doesn't take more than them
+	unsigned long long left = budget ? ((steps < budget) ? budget - steps : 1) : 0;
+	vector<unsigned long long> budgets(chunks, 0);
+	if(left)
 	{
-		p->Reset();
+		for(unsigned int i = 0; i < chunks; i++)
+			budgets[i] = max(static_cast<unsigned long long>(static_cast<double>(left) * (firsts[i + 1] - firsts[i]) / (size + 1)), 1ull);
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
-	{
-		Position start = _s->Where();
 
-		Result r = p->Parse(_s, _tree);
+	//A thread already running tasks of a pool lexes alone, with no chunk lexed beforehand
+	unsigned long long spent = 0;
+	unsigned int threads = pooled ? 1 : Threads(_threads, chunks);
+	if(threads > 1)
+	{
+		vector<WorkStealing::Worker*> workers;
+		for(unsigned int i = 0; i < threads; i++)
+			workers.push_back(new LexWorker(_ignore, _tokens, input, size, lines, *this, firsts, budgets, tables, ends));
 
-		if(!r)
-			return r;
+		WorkStealing pool(workers, chunks);
+		pool.Run();
 
-		if(!_tree)
+		for(unsigned int i = 0; i < workers.size(); i++)
 		{
-			if(insert)
-				_tree = new STNode(start, name);
-			return r;
+			spent += static_cast<LexWorker*>(workers[i])->Spent();
+			delete workers[i];
 		}
+	}
 
-		if(_tree->HasData())
+	//Lex sequentially from where the previous chunk ended until agreeing with the lexing of the chunk, usually at once, with the steps
+	//the chunks left
+	tokens = new TokenTable(kinds);
+	Lexer lexer(_ignore, _tokens, input, size, lines, *this);
+	size_t cursor = 0;
+	for(unsigned int i = 0; i < chunks; i++)
+	{
+		unsigned long long rest = left ? ((spent + lexer.Spent() < left) ? left - spent - lexer.Spent() : 1) : 0;
+
+		size_t joined = static_cast<size_t>(-1);
+		if(cursor < firsts[i + 1] && !lexer.Aborted())
+			cursor = lexer.Run(cursor, firsts[i + 1], *tokens, rest, tables[i], &joined);
+
+		if(joined != static_cast<size_t>(-1))
 		{
-			if(insert)
-			{
-				STNode* n = new STNode(_tree->where, name);
-				n->AddSon(_tree);
-				_tree = n;
-			}
+			tokens->Append(*tables[i], joined);
+			cursor = ends[i];
 		}
-		else
-			_tree->data = name;
 
-		return r;
+		delete tables[i];
+	}
+
+	//The parse goes on with the steps lexing left, and can't go on beyond the limits it exceeded
+	steps += spent + lexer.Spent();
+	if(lexer.Aborted())
+	{
+		delete tokens;
+		tokens = 0;
+		aborted = true;
+	}
+}
+
+
+//Push parsing
+PushParser::~PushParser() {}
+
+/**
+* @brief Input fed to a PushParser and not yet read by the parsing thread.
+*/
+struct Feeding
+{
+	mutex				lock;
+	condition_variable	fed;
+	string				pending;
+	bool				finished;
+
+	Feeding()
+		: finished(false)
+	{
 	}
 };
 
-
-class RootParser : public Parser
+/**
+* @brief Stream on the input fed so far, which waits for more when its end is reached before the input is finished.
+* Only the parsing thread reads it, so only the hand-over of pending input is locked.
+*/
+class FedStream : public StreamImpl
 {
-	Parser* p;
-	int index;
-	
-public:
-	RootParser(Parser* _p, int _index)
-		: p(_p), index(_index)
+	Feeding&	   feeding;
+	mutable string buffer; //!< Input taken from feeding, which only grows
+
+	/**
+	* @brief Waits for more input. Returns false if it has been finished and there is no more.
+	*/
+	bool Wait() const
 	{
+		unique_lock<mutex> guard(feeding.lock);
+		while(feeding.pending.empty() && !feeding.finished)
+			feeding.fed.wait(guard);
+
+		if(feeding.pending.empty())
+			return false;
+
+		buffer += feeding.pending;
+		feeding.pending.clear();
+		input = buffer.data();
+		size  = buffer.size();
+		return true;
 	}
-	virtual ~RootParser()
+public:
+	FedStream(Feeding& _feeding)
+		: StreamImpl(0, 0, false), feeding(_feeding)
 	{
-		delete p;
 	}
-	virtual void Reset()
+	virtual bool AtEnd() const
 	{
-		p->Reset();
+		return StreamImpl::AtEnd() && !Wait();
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	virtual const char* Rest(size_t& _size) const
 	{
-		Result r = p->Parse(_s, _tree);
-
-		if(!_tree || _tree->HasData())
-			return r;
-
-		if(static_cast<unsigned int>((abs(index) - 1)) >= _tree->Sons())
-			return r;
-
-		if(index == 0)
-			return r;
-
-
-		int real_index = index > 0 ? index - 1 : (_tree->Sons() + index);
-		STNode* son = _tree->Son(real_index);
-		_tree->Unlink(son);
-		_tree->Merge(son, real_index);
-		_tree->data = son->data;
-		_tree->where = son->where;
-		delete son;
-
-		return r;
+		//Not all of it until finished, so parsers which would read it in place go on sequentially instead of waiting
+		_size = 0;
+		return 0;
 	}
 };
 
-class FlatParser : public Parser
+class PushParserImpl : public PushParser
 {
-	Parser* p;
-	int index;
-
-	class Flatenizer : public TreeVisitor
-	{
-		STNode* result;
-	public:
-		Flatenizer(const Position& _originalNodePosition)
-			: result(new STNode(_originalNodePosition))
-		{
-		}
-		bool Visit(STNode* _node, unsigned int _level)
-		{
-			if(_node->HasData())
-			{
-				result->AddSon(_node);
-				return false;
-			}
+	Parser*		p;
+	Feeding		feeding;
+	FedStream	s;
 
-			return true;
-		}
-		STNode* GetResult()
-		{
-			return result;
-		}
-	};
+	Result		result;
+	STNode*		tree;
+	Error		error;
+	thread		parsing;
 
-	class Unlinker : public TreeVisitor
+	void Parse()
+	{
+		ParseContext c(&s);
+		result = ParseInTwoPhases(p, c, tree, error);
+	}
+	void End()
 	{
-	public:
-		bool Visit(STNode* _node, unsigned int _level)
 		{
-			if(_node->HasData())
-				return false;
-
-			_node->UnlinkAll();
-			delete _node;
-			return true;
+			lock_guard<mutex> guard(feeding.lock);
+			feeding.finished = true;
 		}
-	};
-
+		feeding.fed.notify_one();
+		parsing.join();
+	}
 public:
-	FlatParser(Parser* _p, int _index)
-		: p(_p), index(_index)
+	PushParserImpl(Parser* _p)
+		: p(_p), s(feeding), tree(0)
 	{
+		parsing = thread(&PushParserImpl::Parse, this);
 	}
-	virtual ~FlatParser()
+	virtual ~PushParserImpl()
 	{
-		delete p;
+		if(parsing.joinable())
+			End();
+		delete tree;
 	}
-	virtual void Reset()
+	virtual void Feed(const char* _data, size_t _size)
 	{
-		p->Reset();
+		{
+			lock_guard<mutex> guard(feeding.lock);
+			if(feeding.finished)
+				return;
+			feeding.pending.append(_data, _size);
+		}
+		feeding.fed.notify_one();
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	virtual Result Finish(STNode*& _tree, Error& _error)
 	{
-		Result r = p->Parse(_s, _tree);
+		_tree = 0;
+		if(!parsing.joinable())
+			return Failure(0);
 
-		if(!_tree || _tree->HasData())
-			return r;
+		End();
 
-		if(static_cast<unsigned int>((abs(index) - 1)) >= _tree->Sons())
-			return r;
+		_tree = tree;
+		_error = error;
+		tree = 0;
+		return result;
+	}
+};
 
-		if(index == 0)
-			return r;
+PushParser* PushParse(Parser* _p)
+{
+	return new PushParserImpl(_p);
+}
 
-		int real_index = index > 0 ? index - 1 : (_tree->Sons() + index);
-		STNode* son = _tree->Son(real_index);
-		if(son->HasData())
-			return r;
 
-		_tree->Unlink(son);
+//Incremental parsing
+IncrementalParser::~IncrementalParser() {}
 
-		Flatenizer f(son->where);
-		PreWalk(son, &f);
-		
-		_tree->Merge(f.GetResult(), real_index);
+class IncrementalParserImpl : public IncrementalParser
+{
+	Parser*		   p;
+	EditableStream s;
+	ParseContext   c; //!< Kept from a parse to the next, without diagnostics, as errors are not kept
+public:
+	IncrementalParserImpl(Parser* _p, const string& _text)
+		: p(_p), s(_text), c(&s, false)
+	{
+		c.Track(&s);
+	}
+	virtual void Edit(size_t _offset, size_t _removed, const string& _inserted)
+	{
+		_offset = min(_offset, s.Text().size());
+		_removed = min(_removed, s.Text().size() - _offset);
 
-		Unlinker u;
-		PostWalk(son, &u);
+		Position first = s.At(_offset);
+		Position last = s.At(_offset + _removed);
+		s.Edit(_offset, _removed, _inserted);
+		c.Edited(first, last, s.At(_offset + _inserted.size()));
+	}
+	virtual Result Parse(STNode*& _tree, Error& _error)
+	{
+		s.Goto(Position(1, 1));
+		Result r = p->Parse(c, _tree);
+		if(r || r.aborted)
+			return r;
 
+		s.Goto(Position(1, 1));
+		ParseContext diagnostic(&s);
+		r = p->Parse(diagnostic, _tree);
+		if(!r)
+			_error = diagnostic.Report(r.error);
 		return r;
 	}
+	virtual const string& Text()
+	{
+		return s.Text();
+	}
 };
 
-class LeftParser : public Parser
+IncrementalParser* IncrementalParse(Parser* _p, const string& _text)
 {
-	Parser* p;
+	return new IncrementalParserImpl(_p, _text);
+}
+
+AppendParser::~AppendParser() {}
 
+class AppendParserImpl : public AppendParser
+{
+	Parser*		   p;
+	EditableStream s;
+	ParseContext   c;
+	Position	   committed; //!< End of the last item committed
 public:
-	LeftParser(Parser* _p)
-		: p(_p)
-	{
-	}
-	virtual ~LeftParser()
+	AppendParserImpl(Parser* _p)
+		: p(_p), s(""), c(&s, false), committed(1, 1)
 	{
-		delete p;
+		c.Track(&s);
 	}
-	virtual void Reset()
+	virtual void Append(const char* _data, size_t _size)
 	{
-		p->Reset();
+		Position end = s.At(s.Text().size());
+		s.Append(_data, _size);
+		c.Edited(end, end, s.At(s.Text().size()));
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	virtual Result Parse(vector<STNode*>& _committed, vector<STNode*>& _open, Error& _error)
 	{
-		Result r = p->Parse(_s, _tree);
+		Position end = s.At(s.Text().size());
 
-		if(!_tree || _tree->HasData())
-			return r;
+		s.Goto(committed);
+		bool empty = false;
+		while(!s.AtEnd())
+		{
+			Position start = s.Where();
+			s.Examine(start);
 
-		if(_tree->Sons() % 2 == 0)
-			return r;
+			STNode* t = 0;
+			Result r = p->Parse(c, t);
+			empty = r && s.Where() == start;
+			if(!r || empty)
+			{
+				delete t;
+				break;
+			}
 
-		for(unsigned int i = 1; i < _tree->Sons(); i += 2)
-		{
-			if(!_tree->Son(i)->IsLeaf())
-				return r;
+			//Once an item is open, those after it are too, as they start where it ends
+			if(_open.empty() && s.Reach() < end)
+			{
+				_committed.push_back(t);
+				committed = s.Where();
+			}
+			else
+			{
+				_open.push_back(t);
+			}
 		}
+		c.Forget(committed);
+		s.Drop(committed);
 
-		for(unsigned int i = 1; i < _tree->Sons(); i += 2)
+		if(s.AtEnd())
+			return Success();
+
+		//An item which reads no text would be parsed forever from there, and a diagnostic parse would find no error
+		if(empty)
 		{
-			STNode* op = _tree->Son(i);
-			if(i == 1)
-				op->AddSon(_tree->Son(i - 1));
-			else
-				op->AddSon(_tree->Son(i - 2));
-			op->AddSon(_tree->Son(i + 1));
+			_error = Error("non-empty item", s.Where());
+			return Failure(0);
 		}
 
-		STNode* old = _tree;
-		
-		_tree = _tree->Son(_tree->Sons() - 2);
-		
-		old->UnlinkAll();
-		delete old;
-
-		return r;
+		//Diagnose the item which doesn't parse
+		STNode* t = 0;
+		ParseContext diagnostic(&s);
+		Result r = p->Parse(diagnostic, t);
+		delete t;
+		_error = diagnostic.Report(r.error);
+		return Failure(0);
 	}
 };
 
-class RightParser : public Parser
+AppendParser* AppendParse(Parser* _item)
 {
-	Parser* p;
+	return new AppendParserImpl(_item);
+}
 
-public:
-	RightParser(Parser* _p)
-		: p(_p)
+
+//Lazy parsing
+const char* const LAZY_NODE = "<LAZY>";
+
+class LazyParser : public Parser
+{
+	Splitter extent;
+	Parser*	 p;
+
+	/**
+	* @brief Placeholder of the text from _start to the current position of _s, which is read again.
+	*/
+	static STNode* Placeholder(Stream* _s, const Position& _start)
 	{
+		Position end = _s->Where();
+		_s->Goto(_start);
+
+		string text;
+		for(Position where = _start; where < end && !_s->AtEnd(); _s->Next())
+		{
+			char c = _s->Get();
+			text += c;
+			if(c == '\n')
+				where = Position(where.row + 1, 1);
+			else
+				where.column++;
+		}
+
+		STNode* tree = new STNode(_start, LAZY_NODE);
+		tree->AddSon(new STNode(_start, text));
+		return tree;
 	}
-	virtual ~RightParser()
+	/**
+	* @brief Whether a tree has error nodes of errors skipped.
+	*/
+	static bool Recovered(STNode* _tree)
+	{
+		vector<STNode*> pending;
+		if(_tree)
+			pending.push_back(_tree);
+
+		while(!pending.empty())
+		{
+			STNode* node = pending.back();
+			pending.pop_back();
+			if(node->data == ERROR_NODE)
+				return true;
+
+			pending.insert(pending.end(), node->childs.begin(), node->childs.end());
+		}
+		return false;
+	}
+public:
+	LazyParser(const Splitter& _extent, Parser* _p)
+		: extent(_extent), p(_p)
 	{
-		delete p;
 	}
-	virtual void Reset()
+	virtual ~LazyParser()
 	{
-		p->Reset();
+		delete p;
 	}
-	virtual Result Parse(Stream* _s, STNode*& _tree)
+	virtual Result Parse(ParseContext& _c, STNode*& _tree)
 	{
-		Result r = p->Parse(_s, _tree);
+		Stream* _s = _c.Input();
+		_tree = 0;
+		Position start = _s->Where();
 
-		if(!_tree || _tree->HasData())
-			return r;
+		//Its text is not checked, so to be diagnosed it is parsed. It is still left as a placeholder, as in the fast path, unless it has
+		//errors skipped, whose nodes must stay in the tree to be reported.
+		if(_c.Diagnoses() || _c.Recovers())
+		{
+			Result r = p->Parse(_c, _tree);
+			if(!r || Recovered(_tree))
+				return r;
 
-		if(_tree->Sons() % 2 == 0)
+			delete _tree;
+			_tree = Placeholder(_s, start);
 			return r;
+		}
 
-		for(unsigned int i = 1; i < _tree->Sons(); i += 2)
+		//The extent of a nesting is known at once from the index, and the head jumps to its end
+		StructureIndex* index = _c.Structure(extent);
+		if(index)
 		{
-			if(!_tree->Son(i)->IsLeaf())
-				return r;
+			size_t first = index->Offset(start);
+			size_t end = index->End(first);
+			if(end && extent.nesting.find(index->Text()[first]) != string::npos && _s->Skip(end - first, index->At(end)))
+			{
+				_tree = new STNode(start, LAZY_NODE);
+				_tree->AddSon(new STNode(start, string(index->Text() + first, end - first)));
+				return Success();
+			}
 		}
 
-		for(int i = _tree->Sons() - 2; i > 0; i -= 2)
+		//Up to the closer of the first char, if it opens a nesting, or to the terminator
+		string text;
+		SplitScan scan(extent);
+		for(bool ended = false; !ended; )
 		{
-			STNode* op = _tree->Son(i);
-			op->AddSon(_tree->Son(i - 1));
+			if(_s->AtEnd())
+			{
+				_s->Goto(start);
+				return Failure(0);
+			}
 
-			if(i == _tree->Sons() - 2)
-				op->AddSon(_tree->Son(i + 1));
-			else
-				op->AddSon(_tree->Son(i + 2));
+			char c = _s->Get();
+			SplitScan::Char kind = scan.Next(c);
+			ended = (kind == SplitScan::TERMINATOR) || (kind == SplitScan::CLOSER);
+			text += c;
+			_s->Next();
 		}
 
-		STNode* old = _tree;
+		_tree = new STNode(start, LAZY_NODE);
+		_tree->AddSon(new STNode(start, text));
+		return Success();
+	}
+};
 
-		_tree = _tree->Son(1);
+Parser* Lazy(const Splitter& _extent, Parser* _p) {return new MemoryParser(new LazyParser(_extent, _p));}
 
-		old->UnlinkAll();
-		delete old;
+Result Expand(STNode* _node, Parser* _p, Error& _error, STNode* _parent)
+{
+	if(!_node || _node->data != LAZY_NODE || _node->Sons() != 1)
+		return Success();
 
+	const string& text = _node->Son(0)->data;
+	StreamImpl s(text.data(), text.size(), false, _node->where);
+	ParseContext c(&s);
+
+	STNode* tree = 0;
+	Result r = ParseInTwoPhases(_p, c, tree, _error);
+	if(r && !s.AtEnd())
+	{
+		_error = Error("EOI", s.Where());
+		r = Failure(0);
+	}
+	if(!r)
+	{
+		delete tree;
 		return r;
 	}
-};
 
-Parser* Name (const string& _name, bool _insert, Parser* _p){return new NameParser(_p, _name, _insert);}
-Parser* Root (int _index, Parser* _p)						{return new RootParser(_p, _index);}
-Parser* Flat (int _index, Parser* _p)						{return new FlatParser(_p, _index);}
-Parser* Left (Parser* _p)									{return new LeftParser(_p);}
-Parser* Right(Parser* _p)									{return new RightParser(_p);}
+	//Without a tree there is no node, as in a parse with _p, so the placeholder is removed from its parent, if it has one
+	if(!tree && _parent)
+	{
+		_parent->Unlink(_node);
+		delete _node;
+		return r;
+	}
+
+	//The placeholder becomes the tree
+	delete _node->Son(0);
+	_node->UnlinkAll();
+	_node->data = "";
+	if(tree)
+	{
+		_node->where = tree->where;
+		_node->data = tree->data;
+		_node->childs = tree->childs;
+		tree->UnlinkAll();
+		delete tree;
+	}
+	return r;
+}
+
+
+//Optimization
+void Optimize(const vector<Parser**>& _rules)
+{
+	Optimizer optimizer(_rules);
+	for(unsigned int i = 0; i < _rules.size(); i++)
+		optimizer.Optimize(*_rules[i]);
+
+	optimizer.Next();
+	for(unsigned int i = 0; i < _rules.size(); i++)
+		*_rules[i] = optimizer.Optimize(*_rules[i]);
+
+	optimizer.Next();
+	for(unsigned int i = 0; i < _rules.size(); i++)
+		*_rules[i] = optimizer.Optimize(*_rules[i]);
+}
@@ -11,8 +11,12 @@
 #ifndef __LANGUAGES_H__
 #define __LANGUAGES_H__
 
+#include <cstdio>
 #include <string>
 #include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
 using namespace std;
 
 /**
@@ -66,6 +70,25 @@ public:
 	* @return True if successful, false otherwise.
 	*/
 	virtual bool		Goto(const Position& _newPosition)  = 0;
+	/**
+	* @brief Obtains the next chars at once, to compare them without reading them one by one. The head doesn't move.
+	* @param _size [in] Number of chars.
+	* @return The next _size chars, or 0 if there are not as many or the stream doesn't keep them in memory, as by default.
+	*/
+	virtual const char*	Peek(unsigned int _size) const;
+	/**
+	* @brief Obtains the rest of the input at once, for it to be read in place, as by several threads. The head doesn't move.
+	* @param _size [out] Number of chars from the head to the end.
+	* @return The chars from the head to the end, or 0 if the stream doesn't keep them all in memory, as by default.
+	*/
+	virtual const char*	Rest(size_t& _size) const;
+	/**
+	* @brief Moves the head _count chars ahead at once, as by default it does one by one.
+	* @param _count [in] Number of chars.
+	* @param _to    [in] Position of the char _count chars ahead, which the caller must know.
+	* @return True if successful, false if there are not as many chars.
+	*/
+	virtual bool		Skip(size_t _count, const Position& _to);
 };
 
 /**
@@ -167,6 +190,190 @@ void PreWalk	(STNode* _root, TreeVisitor* _visitor);  //!< Walks the _root tree
 void InWalk		(STNode* _root, TreeVisitor* _visitor);  //!< Walks the _root tree in inorder.   _visitor->Visit() is invoker per-node.
 void PostWalk	(STNode* _root, TreeVisitor* _visitor);  //!< Walks the _root tree in postorder. _visitor->Visit() is invoker per-node.
 
+/**
+* @brief Structural equality of trees: same data and equal sons, in the same order. Positions are not compared.
+* Identical nodes are equal without further inspection, so comparing two trees interned in the same STNodeTable is O(1).
+*/
+bool Equal(STNode* _a, STNode* _b);
+
+/**
+* @brief Hash-consing table for ST trees.
+* Interns trees so that structurally identical (data, sons) subtrees are stored only once and shared among its parents.
+* Memory needed is then proportional to the number of distinct subtrees.
+* Interned nodes are owned by the table: they must not be modified nor deleted, and are released when the table is.
+* A shared node keeps the position of the first occurrence interned.
+*/
+class STNodeTable
+{
+public:
+	virtual ~STNodeTable(); //!< Deletes every interned node.
+
+	/**
+	* @brief Interns a tree, bottom-up.
+	* Nodes of _tree already interned are reused, and nodes equal to already interned ones are deleted.
+	* @param _tree [in] Tree to intern. The table takes its ownership.
+	* @return The interned tree, equal to _tree. 0 if _tree is 0.
+	*/
+	virtual STNode*		 Intern(STNode* _tree) = 0;
+	/**
+	* @brief Number of distinct nodes interned.
+	*/
+	virtual unsigned int Size()				   = 0;
+};
+
+/**
+* @brief Return a new, empty, hash-consing table.
+*/
+STNodeTable* HashConsing();
+
+/**
+* @brief Read only view of a syntax tree saved in binary format.
+* The format is made of plain arrays indexed by number (node records, son indices and a string table), in the byte order
+* of the host, so an image can be memory-mapped and walked in place, without building any STNode.
+* Images are checked when loaded, so a corrupt one is rejected, and can't be read by a host of the other byte order.
+* Nodes are identified by its index, being 0 the root, and sons have greater indexes than their parents.
+* Shared subtrees (@see STNodeTable) are stored once.
+*/
+class STImage
+{
+public:
+	virtual ~STImage();
+
+	virtual unsigned int Nodes	()										= 0; //!< Number of nodes in the image.
+	virtual const char*	 Data	(unsigned int _node)					= 0; //!< Data of the node, as a null terminated string.
+	virtual Position	 Where	(unsigned int _node)					= 0; //!< Position in the stream where the node was created.
+	virtual unsigned int Sons	(unsigned int _node)					= 0; //!< Number of children the node has.
+	virtual unsigned int Son	(unsigned int _node, unsigned int _index)	= 0; //!< Index of the son _index (0-based) of the node. Nodes() if _index is invalid.
+
+	/**
+	* @brief Builds an ST tree equal to the one in the image.
+	* @return A new tree, to be deleted by the caller. 0 if the image is empty.
+	*/
+	virtual STNode*		 Tree	()										= 0;
+};
+
+/**
+* @brief Saves a tree in binary format.
+* @param _tree     [in] Tree to save.
+* @param _fileName [in] Path of the file to write to.
+* @return True if the file has been written, false otherwise.
+*/
+bool	 SaveTree	(STNode* _tree, const char* _fileName);
+/**
+* @brief Loads a tree saved in binary format. The file is read at once and is not deserialized.
+* @param _fileName [in] Path of the file to read from.
+* @return The image of the tree. 0 if the file could not be read or is not a valid image.
+*/
+STImage* LoadTree	(const char* _fileName);
+/**
+* @brief Views as a tree image a memory block (for instance, a memory-mapped file) with a tree saved in binary format.
+* The memory is not copied, so it must be valid while the image is in use, unless it is not aligned to the words of the image:
+* then it is copied, as they can't be read in place.
+* @param _first [in] Start of the memory block.
+* @param _last  [in] End of the memory block.
+* @return The image of the tree. 0 if the memory block is not a valid image.
+*/
+STImage* TreeImage	(const char* _first, const char* _last);
+
+/**
+* @brief Writes trees into files in a given format.
+* Nodes are walked iteratively and written through a large buffer, formatting numbers by hand, so there are no per-node flushes.
+*/
+class TreeEmitter
+{
+public:
+	virtual ~TreeEmitter();
+
+	/**
+	* @brief Writes a tree.
+	* @param _tree [in] Tree to write.
+	* @param _file [in] File to write to. Text formats expect it opened in text mode, binary format in binary mode.
+	* @return True if the whole tree has been written, false otherwise.
+	*/
+	virtual bool			   Emit	(STNode* _tree, FILE* _file) = 0;
+	/**
+	* @brief Number of bytes written by the last call to Emit.
+	*/
+	virtual unsigned long long Bytes()							 = 0;
+};
+
+/**
+* @brief Indented text: one node per line, prefixed by as many tabs as its level.
+* Node data is followed by "(row, column)" if _showPosition is true.
+*/
+TreeEmitter* TextEmitter		(bool _showPosition);
+/**
+* @brief JSON: every node is an object {"data": "...", "sons": [...]}.
+* Node position is added as "row" and "column" members if _showPosition is true.
+*/
+TreeEmitter* JsonEmitter		(bool _showPosition);
+/**
+* @brief S-expressions: every node is a list ("data" sons...), and leaves are just "data".
+* If _showPosition is true, every node is a list ("data" row column sons...).
+*/
+TreeEmitter* SExpressionEmitter	(bool _showPosition);
+/**
+* @brief Binary format. @see SaveTree
+*/
+TreeEmitter* BinaryEmitter		();
+
+/**
+* @brief Index over a tree for fast queries, built once after parsing.
+* Maps node data to the nodes having it, and source positions to the innermost node covering them.
+* The extent of a node goes from the first position of its subtree to the first position of the next sibling of it, or of its
+* nearest ancestor having one, or else to the end of the input. Node data is never taken as text, so renamed nodes are covered too.
+* The tree must not be modified (nor deleted) while the index is in use, and must not have shared subtrees.
+*/
+class TreeIndex
+{
+public:
+	virtual ~TreeIndex();
+
+	/**
+	* @brief Nodes whose data is _data, in preorder.
+	*/
+	virtual vector<STNode*> Nodes		(const string& _data)				   = 0;
+	/**
+	* @brief Nodes in the subtree of _node (_node not included) whose data is _data, in preorder.
+	*/
+	virtual vector<STNode*> Descendants	(STNode* _node, const string& _data) = 0;
+	/**
+	* @brief Innermost node whose extent covers _where.
+	* @return The node. 0 if no node covers _where.
+	*/
+	virtual STNode*			At			(const Position& _where)			   = 0;
+	/**
+	* @brief Innermost node whose extent covers the char at _offset of the input, in near-constant time.
+	* @return The node. 0 if no node covers it, or if the index was not built with the text of the input.
+	*/
+	virtual STNode*			AtOffset	(size_t _offset)					   = 0;
+	/**
+	* @brief Parent of a node.
+	* @return The parent node. 0 for the root or nodes not in the tree.
+	*/
+	virtual STNode*			Parent		(STNode* _node)					   = 0;
+	/**
+	* @brief Ancestors of a node, from its parent up to the root.
+	*/
+	virtual vector<STNode*> Ancestors	(STNode* _node)					   = 0;
+};
+
+/**
+* @brief Builds the index of a tree.
+* @param _root [in] Tree to index.
+* @param _end  [in] End of the input parsed into _root, where the extent of the root ends. By default, it never ends.
+* @return The index of the tree.
+*/
+TreeIndex* IndexTree(STNode* _root, const Position& _end = Position(~0u, ~0u));
+/**
+* @brief Builds the index of a tree with the text of the input parsed into it, which also finds nodes by offset.
+* @param _root  [in] Tree to index.
+* @param _first [in] Start of the input, from position (1, 1).
+* @param _last  [in] End of the input, where the extent of the root ends.
+* @return The index of the tree.
+*/
+TreeIndex* IndexTree(STNode* _root, const char* _first, const char* _last);
+
 
 
 /**
@@ -225,7 +432,7 @@ struct Error
 	/**
 	* @brief Constructor.
 	* @param _where    [in] Position of the error in the stream.
-	* @param _expected [in] Single string containing an acceptable char associated with this error.
+	* @param _expected [in] Single string containing an acceptable char associated with this error. None if empty.
 	*/
 	Error(const string& _expected = "", const Position& _where = Position());
 
@@ -242,17 +449,35 @@ struct Error
 };
 
 /**
-* @brief Result of a Parser. Retrieves both if the parser has succeeded and associated data such as the ST tree in case of success
-* and the error in case of failure.
+* @brief Identifies what a parser expects to find, such as the chars of a Char parser or the string of a Word parser.
+* Expectations are interned: parsers get them when built, parsing only handles these numbers, 
+* and their descriptions are only looked up when an error is reported.
+*/
+typedef unsigned int Expectation;
+
+Expectation Expect		(const string& _description); //!< Interns a description. Equal descriptions get the same expectation.
+string		Description	(Expectation _expectation);   //!< Description of an interned expectation.
+
+/**
+* @brief Identifies the error of a result, kept by the ParseContext of the parse. 0 means there is no error.
+* The context only keeps the furthest failure, so every error refers to it.
+*/
+typedef unsigned int ErrorHandle;
+
+/**
+* @brief Result of a Parser. Retrieves both if the parser has succeeded and, in case of failure, the error.
 * Also, due to optional parsers (*, +, ?), there maybe an error associated even in the case of success, and this error must be propagated.
+* Errors are kept by the ParseContext and referred by handle, so a Result is a plain value, cheap to return and to memorize.
+* A parse stopped by the limits of its ParseContext ends with an aborted result, which is a failure that no parser turns into success.
 * Behaves also as a bool value.
 */
 struct Result
 {
-	bool	match; //!< Success
-	Error	fail;  //!< Error
+	bool		match;	 //!< Success
+	bool		aborted; //!< Parsing was stopped before finishing. @see ParseContext::Abort
+	ErrorHandle	error;	 //!< Error, if not 0. @see ParseContext
 
-	Result(bool _match = false, const Error& _fail = Error());
+	Result(bool _match = false, ErrorHandle _error = 0);
 
 	operator bool();    //!< Indicates the success or failure
 	Result operator!(); //!< Negates the result
@@ -264,34 +489,306 @@ struct Result
 * @brief Constructs a successful result.
 * Can be empty, have an associated ST tree and, optionally, an error.
 */
-Result Success(const Error& _fail = Error());
+Result Success(ErrorHandle _error = 0);
 /**
 * @brief Constructs a failure result.
 * Has an associated error.
 */
-Result Failure(const Error& _fail);
+Result Failure(ErrorHandle _error);
+/**
+* @brief Constructs an aborted result.
+*/
+Result Aborted();
 
+/**
+* @brief Limits of a parse, given to the entry points which make their own ParseContext. @see ParseContext::Budget
+*/
+struct Limits
+{
+	unsigned long long	steps;		  //!< Maximum steps, 0 if unlimited.
+	unsigned int		milliseconds; //!< Maximum time since the parse starts, 0 if unlimited.
+	const atomic<bool>*	cancel;		  //!< Stops the parse as soon as it is true, if not 0.
 
+	Limits(unsigned long long _steps = 0, unsigned int _milliseconds = 0, const atomic<bool>* _cancel = 0);
+};
 
 
+/**
+* @brief State of a parse: the stream being parsed and the errors found on it.
+* Errors are kept as the furthest position where a parser failed along with the expectations at that position.
+* That single record only grows with the expectations at that position, so failing parsers neither format strings nor copy lists.
+* It also holds the memorization tables of the parse, so parsers are not modified by parsing and a parser can be used
+* by several threads at once, each with its own context.
+*/
+class MemoTable;
+class TokenTable;
+class StructureIndex;
+class EditableStream;
+struct Splitter;
+class Parser;
+class ParseContext
+{
+	Stream*					  input;
+	bool					  diagnose;	 //!< Whether errors are recorded or not.
+	bool					  recover;	 //!< Whether Recover parsers skip errors or not.
+	Position				  farthest;	 //!< Position of the furthest failure, if any expectation.
+	vector<Expectation>		  expectations; //!< What was expected at farthest, from first on. Those before are kept for marks.
+	unsigned int			  first;
+	unsigned int			  kept;		 //!< Expectations kept for the innermost mark.
+	map<Position, Error>	  recovered; //!< Errors skipped by Recover parsers, by position of their error node.
+
+	bool					  limited;	 //!< Whether there is any limit to check.
+	bool					  aborted;
+	unsigned long long		  steps;
+	unsigned long long		  budget;	 //!< Maximum steps, 0 if unlimited.
+	bool					  timed;
+	chrono::steady_clock::time_point deadline;
+	const atomic<bool>*		  cancel;
+	const ParseContext*		  outer;	 //!< Context this one parses part of the input for, whose cancellation stops this one too.
+
+	vector<MemoTable*>		  tables;	 //!< Of MemoryParsers, by slot.
+	TokenTable*				  tokens;	 //!< Built by Lex, if any.
+	vector<StructureIndex*>	  structures; //!< Built by Structure, one for each splitter.
+	EditableStream*			  tracked;	 //!< Input whose examined extent is tracked, for incremental parsing.
+
+	bool Exceeded();
+	bool Cancelled() const;
+
+	ParseContext(const ParseContext&);
+	ParseContext& operator=(const ParseContext&);
+public:
+	/**
+	* @brief Constructor.
+	* @param _s		   [in] Stream to parse.
+	* @param _diagnose [in] Whether to record errors. If not, every error handle is 0: parsing is faster but failures can't be reported.
+	* @param _recover  [in] Whether Recover parsers skip errors up to their synchronization point. @see Recover
+	*/
+	ParseContext(Stream* _s, bool _diagnose = true, bool _recover = false);
+	~ParseContext();
+	/**
+	* @brief Prepares the context for a new parse, as if it were just constructed, but keeping the memory it has already allocated
+	* and its limits. Only the steps taken and whether it was aborted are reset, so a deadline is still counted from when it was set.
+	*/
+	void		Restart(Stream* _s, bool _diagnose = true, bool _recover = false);
+
+	Stream*		Input();	 //!< Stream being parsed.
+	bool		Diagnoses(); //!< Whether errors are being recorded.
+	bool		Recovers();	 //!< Whether errors are being recovered.
+
+	/**
+	* @brief Records a failure. Only the furthest one is kept: failures behind it are dropped, and those at the same
+	* position add what they expected to it.
+	* @param _expected [in] What the failing parser expected.
+	* @param _where    [in] Position in the stream of the error.
+	* @return Handle of the error.
+	*/
+	ErrorHandle Fail	(Expectation _expected, const Position& _where);
+	/**
+	* @brief Aggregates errors, as Error::operator+= does. As only the furthest failure is kept, it is already aggregated.
+	* @return Handle of the aggregated error.
+	*/
+	ErrorHandle Merge	(ErrorHandle _a, ErrorHandle _b);
+	/**
+	* @brief Builds the Error, with the descriptions of what was expected, from a handle.
+	*/
+	Error		Report	(ErrorHandle _error);
+
+	/**
+	* @brief State of the error record when a parser starts tracking the failures of its parser apart.
+	* Failures are then recorded afresh, until the mark is ended either keeping them, aggregated to those before, or dropping them.
+	*/
+	struct ErrorMark
+	{
+		Position	 farthest;
+		unsigned int first;
+		unsigned int size;
+		unsigned int kept;
+	};
+	ErrorMark	Mark	();
+	void		Keep	(const ErrorMark& _mark); //!< Ends _mark, keeping the failures recorded since.
+	void		Drop	(const ErrorMark& _mark); //!< Ends _mark, forgetting the failures recorded since.
+	/**
+	* @brief Failures recorded since the innermost mark, for a memorized result to replay them when it is remembered, as its
+	* parsers then don't run to record them again. @see Replay
+	* @param _where	   [out] Position of the furthest one.
+	* @param _expected [out] What they expected there, empty if none was recorded.
+	*/
+	void		Recorded(Position& _where, vector<Expectation>& _expected);
+	void		Replay	(const Position& _where, const vector<Expectation>& _expected); //!< Records those failures again.
+
+	/**
+	* @brief Records an error skipped by a Recover parser.
+	* @param _node  [in] Position of the error node which replaces the skipped input.
+	* @param _error [in] Error skipped.
+	*/
+	void		Recovered(const Position& _node, const Error& _error);
+	/**
+	* @brief Builds the errors skipped in a tree, in the order of their error nodes.
+	* Only error nodes in the tree count, so errors skipped in alternatives later discarded are not reported.
+	*/
+	void		Report	(STNode* _tree, vector<Error>& _errors);
+
+	/**
+	* @brief Limits the parse to a number of steps, that is, of combinators entered.
+	*/
+	void		Budget		(unsigned long long _steps);
+	/**
+	* @brief Limits the parse to end in _milliseconds from now. The clock is only read once every few steps.
+	*/
+	void		Timeout		(unsigned int _milliseconds);
+	/**
+	* @brief Stops the parse as soon as *_cancel becomes true, which can be set from any thread.
+	*/
+	void		Cancellation(const atomic<bool>* _cancel);
+	/**
+	* @brief Sets every limit of _limits, as Budget, Timeout and Cancellation do. Those not given in _limits are removed.
+	*/
+	void		Limit		(const Limits& _limits);
+	/**
+	* @brief Takes the limits of _outer, for a context parsing part of its input on another thread: its deadline, what is left of
+	* its budget, and its cancellation, so that whatever stops _outer stops this one too. Any cancellation of this one is removed.
+	*/
+	void		Inherit		(const ParseContext& _outer);
+	/**
+	* @brief Checks the limits of the parse. Called by combinators when entered, they return Aborted() once it is true.
+	* @return Whether parsing must stop.
+	*/
+	bool		Abort		();
+	bool		Stopped		(); //!< Whether any limit has been exceeded, so the parse has been aborted.
+	unsigned long long Steps(); //!< Steps taken so far, counted only while there is any limit.
+
+	/**
+	* @brief Memorization table of the MemoryParser with that slot, created on first use.
+	*/
+	MemoTable*	Table		(unsigned int _slot);
+
+	/**
+	* @brief Lexes the input, from its current position to its end, so that Lexed parsers find their tokens already recognized.
+	* Only when parsing without diagnostics an input held in memory (@see Stream::Rest), which is read in place. At each token start,
+	* every kind of token is tried, and lexing goes on after the longest match, or after a char if none matches. The input is split
+	* in chunks of lines, lexed in parallel on the threads of a shared pool as if each began with a token. The lexing of a chunk is
+	* kept from the first point where it agrees with that of the chunks before it. On a thread of the pool, as when parsing a batch,
+	* the input is lexed sequentially. Lexing is within the limits of the parse, which is aborted if they are exceeded. The steps left
+* are shared by the chunks, as their lengths are, and those taken by lexing are charged to the parse.
+	* @param _ignore  [in] Parser of what is skipped before each token.
+	* @param _tokens  [in] Parser of each kind of token.
+	* @param _threads [in] Number of threads, or 0 to use as many as the pool has.
+	*/
+	void		Lex			(Parser* _ignore, const vector<Parser*>& _tokens, unsigned int _threads = 0);
+	TokenTable*	Tokens		(); //!< Built by Lex, if any.
+	/**
+	* @brief Index of the structure of the input as _splitter tells: where each nesting closes and each literal ends. It is built on
+	* the first call for that splitter, from the current position to the end, in a single pass which goes over chars of no structure
+	* by a lookup. Lazy parsers find the extent of a nesting from it at once, and jump to its end.
+	* Only when parsing without diagnostics an input held in memory (@see Stream::Rest), which is read in place.
+	* @return The index, or 0 if there is none.
+	*/
+	StructureIndex*	Structure	(const Splitter& _splitter);
+
+	/**
+	* @brief Makes memorized results record how far they examined _s, so that they can survive edits of it. @see IncrementalParse
+	* Pre-lexing and parallel parsers, which read the whole input, are skipped while tracking.
+	*/
+	void			Track	(EditableStream* _s);
+	EditableStream*	Tracked	(); //!< Input being tracked, if any.
+	/**
+	* @brief Updates the memorization tables after the text in [_first, _last) has been replaced by text ending at _end.
+	* Results which examined the replaced text are forgotten, and those after it are moved, along with their trees.
+	*/
+	void			Edited	(const Position& _first, const Position& _last, const Position& _end);
+	/**
+	* @brief Forgets the results memorized before _position, as parsing won't go back there.
+	*/
+	void			Forget	(const Position& _position);
+};
+
+
+
+
+class Optimizer;
+
+/**
+* @brief What a successful parse may begin with. @see Parser::First
+*/
+struct Firsts
+{
+	bool chars[256]; //!< Whether a parse consuming input may begin with each char, by its unsigned value.
+	bool nullable;	 //!< Whether a parse may succeed without consuming input, so at any char or at the end of input.
+
+	Firsts(); //!< Nothing.
+
+	void Add	 (char _c);
+	void AddChars(const Firsts& _firsts);
+	void Anything();
+};
+
+/**
+* @brief State of an analysis with Parser::First.
+*/
+struct FirstsAnalysis
+{
+	vector<Parser*>		 visiting; //!< Rules whose analysis is under way, to stop at left recursion.
+	map<Parser*, Firsts> rules;	   //!< What each rule analyzed so far begins with, as rules are reached by many paths.
+};
+
 /**
 * @brief Parser. Given a Stream, recognizes text from the stream and creates the ST.
+* Parsers are not modified once built: every state of a parse, as the memorization to speed up backtracks, is kept by its ParseContext.
+* So a parser can be used for any number of parses, even at the same time from several threads.
 */
 class Parser
 {
 public:
 	virtual ~Parser();
 	/**
-	* @brief Resets the parser. Parsers have memoization to speed up backtracks.
-	* So after every call to "Parse", the parser should be reset to clear the caches.
+	* @brief Do the actual parsing.
+	* @param _c [in] Context of the parse, with the stream to read from. Errors found are kept into it.
+	* @return Result of parsing. @see Result.
 	*/
-	virtual void   Reset()           = 0;
+	virtual Result Parse(ParseContext& _c, STNode*& _tree) = 0;
 	/**
-	* @brief Do the actual parsing.
+	* @brief Parses a stream from its current position, without recording errors.
 	* @param _s [in] Stream to read from.
 	* @return Result of parsing. @see Result.
 	*/
-	virtual Result Parse(Stream* _s, STNode*& _tree) = 0;
+	Result		   Parse(Stream* _s, STNode*& _tree, const Limits& _limits = Limits());
+	/**
+	* @brief Parses a stream from its current position, reporting the error in case of failure.
+	* It's done in two phases. First without recording errors, as most inputs are correct. On failure the parser is reset and the
+	* stream is parsed again, from the same position, recording errors to report them.
+	* @param _s		 [in]  Stream to read from.
+	* @param _error	 [out] Error, in case of failure.
+	* @param _limits [in]  Limits of the parse. The deadline and the cancellation hold for both phases together, the budget for each.
+	* @return Result of parsing. @see Result.
+	*/
+	Result		   Parse(Stream* _s, STNode*& _tree, Error& _error, const Limits& _limits = Limits());
+	/**
+	* @brief Parses a stream from its current position, recovering from errors at synchronization points. @see Recover
+	* As the two phases parse, on failure the stream is parsed again, this time recording errors and recovering from them.
+	* Syntax errors are reported in order, and the resulting tree has an error node in place of the input skipped for each.
+	* @param _s		 [in]  Stream to read from.
+	* @param _errors [out] Errors found. If the parse failed, the last one is the failure error.
+	* @param _limits [in]  Limits of the parse. The deadline and the cancellation hold for both phases together, the budget for each.
+	* @return Result of parsing. @see Result.
+	*/
+	Result		   Parse(Stream* _s, STNode*& _tree, vector<Error>& _errors, const Limits& _limits = Limits());
+	/**
+	* @brief Adds to _firsts what a successful parse without diagnostics may begin with, so that choices skip the alternatives
+	* which can't succeed. It may tell more than what is possible, never less. By default it tells anything, which is always safe.
+	* @param _firsts   [in/out] What to add to.
+	* @param _analysis [in/out] State of the analysis under way, shared by the parsers it reaches.
+	*/
+	virtual void   First(Firsts& _firsts, FirstsAnalysis& _analysis);
+	/**
+	* @brief Simplifies this parser for Optimize, optimizing its parsers through _optimizer. By default it is left as it is.
+	* @return The parser to use instead, which may be this one. Any other takes what this one did, and this one is deleted by _optimizer.
+	*/
+	virtual Parser* Optimized(Optimizer& _optimizer);
+	/**
+	* @brief Describes this parser for Optimize, so that parsers alike are shared: those with the same signature must parse the same.
+	* It is made of what it does and of _optimizer's ids of its parsers. By default it is empty, so this parser is never shared.
+	*/
+	virtual string	Signature(Optimizer& _optimizer);
 };
 
 //Basic Parsers
@@ -310,6 +807,12 @@ Parser* Plus		(Parser* _p);                       //!< Success if _p succeeds at
 Parser* Repeat		(int _minN, int _maxN, Parser* _p); //!< Success if _p succeeds [_minN, _maxN] times. If _maxN == -1, no upper limit. Consumes until _maxN.
 Parser* Sequence	(unsigned int _number, ...);        //!< Success if specified parsers succeeds all in sequence.
 Parser* Choice		(unsigned int _number, ...);        //!< Success if at least one parser succeeds.
+/**
+* @brief As a Choice of Word parsers, one per string, but matching them all in a single pass over the input, through a trie.
+* The first word, in order, found at the current position wins. Ej: Keywords(3, "*", "+", "?").
+* @param _number [in] Number of words, given as const char* in the variant call.
+*/
+Parser* Keywords	(unsigned int _number, ...);
 
 //Special Parsers
 /**
@@ -332,6 +835,77 @@ Parser* Ignore		(Parser* _p);
 * @param _p      [in] Parser whose error will be cleared
 */
 Parser* Clear		(Parser* _p);
+/**
+* @brief Synchronization point for error recovery.
+* Behaves as _p, except when parsing in recovery mode (@see ParseContext). Then, if _p fails, its error is recorded and the input is
+* skipped until _sync succeeds (consuming it) or the input ends, producing an error node with data ERROR_NODE. Fails if no input is skipped.
+* Ej: Recover(Ignore(Word(";")), _p) skips an ill-formed _p up to the next ';'.
+* @param _sync   [in] Parser which finds where to resume parsing
+* @param _p      [in] Parser to recover from
+*/
+Parser* Recover		(Parser* _sync, Parser* _p);
+extern const char* const ERROR_NODE; //!< Data of the nodes produced by Recover when skipping input.
+/**
+* @brief Behaves as _p, a token of kind _kind in ParseContext::Lex, but taking the token from the table built by Lex when there is one
+* and it has a token start at the current position. Positions which the lexer skipped are parsed by _p.
+* @param _kind [in] Index of the token in the parsers given to ParseContext::Lex.
+* @param _p    [in] Parser of the token, the same given to ParseContext::Lex.
+*/
+Parser* Lexed		(unsigned int _kind, Parser* _p);
+/**
+* @brief Tells how to find, with a plain scan of the input, where the items of a repetition may end. @see Parallel
+*/
+struct Splitter
+{
+	char   terminator; //!< Ends an item, when found out of any nesting, literal or comment
+	string nesting;    //!< Pairs of opening and closing chars, as "()[]"
+	string quotes;     //!< Chars which open and close literals
+	char   comment;    //!< Starts a comment up to the end of the line, 0 if there are none
+
+	Splitter(char _terminator, const string& _nesting = "()[]{}", const string& _quotes = "\"'", char _comment = 0);
+};
+/**
+* @brief As Repeat(_minN, -1, _p), but parsing long inputs in chunks, in parallel.
+* When parsing without diagnostics an input held in memory (@see Stream::Rest), the rest of it is split right after the terminators of
+* _splitter, and the chunks are parsed in place with _p on the threads of a shared pool, within the limits of the parse. The items of a chunk are kept only if they end exactly where the next chunk begins, as those of a sequential
+* parse would do; otherwise, parsing goes on sequentially from that chunk. So the tree is always the same as that of the sequential parse.
+* Ej: Parallel(1, Splitter(';'), _rule) parses a long list of rules ended by ';'.
+* @param _minN     [in] Minimum number of items.
+* @param _splitter [in] How to split the input between items.
+* @param _p        [in] Parser of an item.
+*/
+Parser* Parallel	(int _minN, const Splitter& _splitter, Parser* _p);
+/**
+* @brief As Choice, but trying every alternative at once, on the threads of a shared pool, when parsing without diagnostics an input
+* held in memory (@see Stream::Rest). Each alternative reads the input in place with memo tables of its own, within the limits of
+* the parse. The first one, in order, which succeeds wins, and those after it are cancelled as soon as it does.
+* So it is only worth for a few alternatives which are expensive to try.
+*/
+Parser* ParallelChoice(unsigned int _number, ...);
+/**
+* @brief Skips the text _p would parse by a plain scan of its extent, producing a placeholder node with data LAZY_NODE whose only son
+* is a leaf with the text skipped, to be parsed on demand by Expand. The extent starts at the current position and ends with the closer
+* matching its first char, if that opens a nesting of _extent, or with the terminator of _extent otherwise, out of any nesting.
+* Fails if the input ends first. The end of a nesting is found from the index of the input (@see ParseContext::Structure), if any.
+* The text is only checked once expanded, so when parsing with diagnostics _p parses it instead, and the placeholder is made of what it
+* read. Trees of the fast and the diagnostic paths then have placeholders alike, which callers expand with Expand. Only when recovering
+* errors, a text with errors skipped is left as the tree of _p, as its error nodes are needed to report them.
+* Ej: Lazy(Splitter(0, "{}"), _block) skips a block between braces.
+* There is no notation for it in EBNF grammars, so generated parsers never skip text: it is only for parsers built by hand.
+* @param _extent [in] How to find the extent of the text.
+* @param _p      [in] Parser of the text, when expanded. Its tree should be kept whole by the parsers above.
+*/
+Parser* Lazy		(const Splitter& _extent, Parser* _p);
+extern const char* const LAZY_NODE; //!< Data of the placeholder nodes produced by Lazy.
+/**
+* @brief Parses the text of a placeholder node of Lazy, replacing the node with the tree of _p. Other nodes are left as they are.
+* If _p parses the text with no tree, the node is unlinked from _parent and deleted, as a parse with _p would have no node there.
+* @param _node   [in] Placeholder node.
+* @param _p      [in] Parser given to Lazy. It must parse the whole text.
+* @param _error  [out] Why the text doesn't parse, in case of failure, as Parser::Parse does. The node is left as it was then.
+* @param _parent [in] Optional. Node _node is a son of. Without it, a node with no tree is left with no data nor sons.
+*/
+Result	Expand		(STNode* _node, Parser* _p, Error& _error, STNode* _parent = 0);
 
 
 //Semantic Parsers
@@ -397,4 +971,177 @@ Parser* Left(Parser* _p);
 */
 Parser* Right(Parser* _p);
 
+
+//Optimization
+/**
+* @brief Simplifies a grammar once built, before any parse, without changing what it parses, its trees or its errors.
+* Basic parsers are not memorized, nor already memorized ones again, consecutive alternatives of single chars are fused in one set,
+* sequences and choices of a single parser are replaced by it, an Ignore or Clear right inside another is removed, and so is an
+* Ignore right inside a Clear, which drops the tree itself.
+* Every rule is given by the variable its references point to, which is updated. References to a rule off any cycle are replaced
+* by the parser of the rule, which its variable then stands for, so that it is optimized along with the parsers using it.
+* Parsers shared by several others, as the one given to many Ignore, are optimized once and never replaced.
+* Last, parsers alike, as the same word or token used in several rules, are shared, so that what one memorizes serves all the others.
+* Parsers given to Lazy are left as they are, as they are given to Expand too.
+* @param _rules [in/out] Variables with the rules of the grammar.
+*/
+void Optimize(const vector<Parser**>& _rules);
+
+
+//Batch parsing
+/**
+* @brief Outcome of parsing one of the streams of a batch.
+*/
+struct Parsed
+{
+	unsigned int index;	 //!< Of the stream in the batch.
+	Result		 result;
+	STNode*		 tree;	 //!< Owned by the caller.
+	Error		 error;	 //!< In case of failure.
+
+	Parsed(unsigned int _index = 0);
+};
+
+/**
+* @brief Receives each outcome of a batch as soon as it is parsed. Calls are never concurrent, though made from the parsing threads.
+*/
+class BatchListener
+{
+public:
+	virtual ~BatchListener();
+	virtual void Done(const Parsed& _parsed) = 0;
+};
+
+/**
+* @brief Parses every stream with _p, spread across threads by a work-stealing scheduler.
+* Every thread reuses its ParseContext from a parse to the next. Each stream is parsed as Parser::Parse(Stream*, STNode*&, Error&) does.
+* @param _threads  [in] Number of threads, or 0 to use one per core. Threads are taken from a pool shared by all parses, of one per core.
+* @param _listener [in] Optional. Gets the outcomes as they complete.
+* @param _limits   [in] Limits of the parse of each stream, its time counted from when it starts. A cancellation stops them all.
+* @return Outcomes, in the order of _streams.
+*/
+vector<Parsed> ParseBatch(Parser* _p, const vector<Stream*>& _streams, unsigned int _threads = 0, BatchListener* _listener = 0,
+						  const Limits& _limits = Limits());
+/**
+* @brief Time spent by each stage of ParseFiles.
+*/
+struct Throughput
+{
+	unsigned long long bytes;	//!< Read from the files.
+	double			   reading; //!< Seconds spent reading files.
+	double			   parsing; //!< Seconds spent parsing, added up over the parsing threads.
+	double			   waiting; //!< Seconds the parsing threads waited for files to be read, added up over them.
+	double			   elapsed; //!< Seconds of the whole batch.
+
+	Throughput();
+};
+
+/**
+* @brief As ParseBatch, with the contents of files. Files that can't be open fail with an Error telling so.
+* Files are read in order, ahead of their parsing, into buffers recycled from a file to the next. Parsing runs on the threads of a
+* shared pool, which take turns to read: one reads while the others parse. Each file is parsed by the first thread free once it is read.
+* @param _readAhead  [in] Bytes read and not yet parsed allowed at once. A bigger file is read alone.
+* @param _throughput [out] Optional. Gets the time spent by each stage.
+*/
+vector<Parsed> ParseFiles(Parser* _p, const vector<string>& _files, unsigned int _threads = 0, BatchListener* _listener = 0,
+						  size_t _readAhead = 64 * 1024 * 1024, Throughput* _throughput = 0, const Limits& _limits = Limits());
+/**
+* @brief Parses independent records, one per line, each with _p, spread across threads as ParseBatch does.
+* Records are read in place and their trees have the positions they have in the whole buffer. Empty lines are skipped.
+* @param _first [in] Start of the char array.
+* @param _last  [in] End of the char array.
+* @return Outcomes, one per record, in the order of the buffer.
+*/
+vector<Parsed> ParseRecords(Parser* _p, const char* _first, const char* _last, unsigned int _threads = 0, BatchListener* _listener = 0,
+							const Limits& _limits = Limits());
+/**
+* @brief As ParseRecords, with the contents of a file, which is memory-mapped and read in place, or read at once if it can't be mapped.
+* If it can't be open, there is a single failed outcome telling so.
+*/
+vector<Parsed> ParseRecordFile(Parser* _p, const char* _fileName, unsigned int _threads = 0, BatchListener* _listener = 0,
+							   const Limits& _limits = Limits());
+
+
+//Push parsing
+/**
+* @brief Parses input as it arrives, in chunks. Parsing runs on a thread of its own, which waits whenever it has read all the input
+* fed so far and goes on with the next chunk, so input is never parsed twice and its arrival overlaps with its parsing.
+* As the input is not all in memory until it is finished, it is neither pre-lexed (@see ParseContext::Lex) nor parsed in parallel
+* (@see Parallel, ParallelChoice): those parsers go on sequentially, without waiting for the rest of it.
+*/
+class PushParser
+{
+public:
+	virtual ~PushParser(); //!< If not finished, finishes the input and waits for the parse, discarding it.
+
+	/**
+	* @brief Adds a chunk of input, which is copied. Parsing goes on in the background up to its end.
+	*/
+	virtual void   Feed		(const char* _data, size_t _size) = 0;
+	/**
+	* @brief Ends the input and waits for the parse to end. It parses as Parser::Parse(Stream*, STNode*&, Error&) does.
+	* Only the first call parses; later ones fail with no tree.
+	*/
+	virtual Result Finish	(STNode*& _tree, Error& _error) = 0;
+};
+
+/**
+* @brief Starts parsing with _p the input to be fed to the returned PushParser.
+*/
+PushParser* PushParse(Parser* _p);
+
+
+//Incremental parsing
+/**
+* @brief Text parsed again after each edit, reusing the results memorized by the previous parses which didn't examine the edited text.
+* So the cost of parsing again is mostly that of the parsers over the edited text, rather than that of the whole text.
+*/
+class IncrementalParser
+{
+public:
+	virtual ~IncrementalParser();
+
+	/**
+	* @brief Replaces _removed chars at _offset with _inserted.
+	*/
+	virtual void		  Edit	(size_t _offset, size_t _removed, const string& _inserted) = 0;
+	/**
+	* @brief Parses the current text, as Parser::Parse(Stream*, STNode*&, Error&) does. Failures are diagnosed by a parse from scratch.
+	*/
+	virtual Result		  Parse	(STNode*& _tree, Error& _error) = 0;
+	virtual const string& Text	() = 0; //!< Current text.
+};
+
+/**
+* @brief Starts an incremental parse of _text with _p. Nothing is parsed until the first call to Parse.
+*/
+IncrementalParser* IncrementalParse(Parser* _p, const string& _text);
+
+/**
+* @brief Text which only grows, as a log file, parsed as a sequence of items. Items are committed once they are parsed without examining
+* the end of the text, so that appending can't change them: they are returned once and never parsed again.
+* So the cost of parsing after an append is that of the items from the last one committed, and only the text after it is kept.
+*/
+class AppendParser
+{
+public:
+	virtual ~AppendParser();
+
+	virtual void   Append	(const char* _data, size_t _size) = 0;
+	/**
+	* @brief Parses items from the end of the last one committed.
+	* @param _committed [out] Items committed by this call. Owned by the caller.
+	* @param _open      [out] Items after them, which may change with more text, as the last one usually does. Owned by the caller.
+	* @param _error     [out] In case of failure, why the text after the items doesn't parse as an item. If _item parses there
+	*                         without reading any text, which it would do forever, the error expects a "non-empty item".
+	* @return Failure if there is text after the items, which may be an item not fully appended yet.
+	*/
+	virtual Result Parse	(vector<STNode*>& _committed, vector<STNode*>& _open, Error& _error) = 0;
+};
+
+/**
+* @brief Starts parsing with _item the items of a text, to be appended to the returned AppendParser.
+*/
+AppendParser* AppendParse(Parser* _item);
+
 #endif
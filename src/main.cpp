@@ -1,41 +1,69 @@
 #include <stdlib.h>
 #include <iostream>
-#include <fstream>
+#include <chrono>
+#include <random>
 using namespace std;
 
 #include "EBNF.h"
 
-class PrintVisitor : public TreeVisitor
-{
-	ostream& out;
-	bool showPosition;
-public:
-	PrintVisitor(ostream& _stream, bool _showPosition);
-	virtual bool Visit(STNode* _node, unsigned int _level);
-};
+TreeEmitter* GetEmitter(const string& _format, bool _showPosition, string& _extension, bool& _binary);
+bool EmitTree(STNode* _tree, TreeEmitter* _emitter, const string& _fileName, bool _binary);
 
 string GetPath(const string& _fullFileName);
 string GetName(const string& _fullFileName);
 string Translate(char _c);
 
-void ParserFailure		 (const Result& _r, Stream* _s);
-void SemanticsFailure	 (const Result& _r);
-void CodeGeneratorFailure(const Result& _r);
+void ParserFailure		 (const Error& _e, Stream* _s);
+void SemanticsFailure	 (const Error& _e);
+void CodeGeneratorFailure(const Error& _e);
+
+bool SameTree	(STNode* _a, STNode* _b);
+void CheckEdits	(Stream* _s, unsigned int _edits);
 
 int main(int argc, char* argv[])
 {
 	//Check parameters
-	if(argc != 2 && argc != 3)
+	if(argc < 2 || argc > 8)
 	{
-		cout << "Use: " << argv[0] << " <EBNF file> [-p]" << endl;
+		cout << "Use: " << argv[0] << " <EBNF file> [-p] [-f <format>] [-b] [-r] [-e <edits>]" << endl;
 		cout << "\t<EBNF file> = file with language description" << endl;
 		cout << "\t-p = Shows position in the stream of the AST nodes in the AST Tree output" << endl;
+		cout << "\t-f = Format of the AST Tree output: text (.st, default), json (.json), sexp (.sexp) or bin (.stb)" << endl;
+		cout << "\t-b = Same as -f bin. Binary output is loadable with LoadTree" << endl;
+		cout << "\t-r = Recovers from syntax errors to report all of them" << endl;
+		cout << "\t-e = Checks incremental parsing instead: makes that many random edits to the file, parsing it incrementally" << endl;
+		cout << "\t     after each one, and compares the outcome with that of a parse from scratch" << endl;
 		return 0;
 	}
 
-	//Obtain file to parse and whether to show node's position or not
+	//Obtain file to parse, whether to show node's position or not, output format, whether to recover from errors and edits to check
 	char* fileName = argv[1];
-	bool showPosition = (argc == 3) && (argv[2] == string("-p"));
+	bool showPosition = false;
+	bool recover = false;
+	unsigned int edits = 0;
+	string format = "text";
+	for(int i = 2; i < argc; i++)
+	{
+		if(argv[i] == string("-p"))
+			showPosition = true;
+		else if(argv[i] == string("-b"))
+			format = "bin";
+		else if(argv[i] == string("-r"))
+			recover = true;
+		else if(argv[i] == string("-f") && i + 1 < argc)
+			format = argv[++i];
+		else if(argv[i] == string("-e") && i + 1 < argc)
+			edits = atoi(argv[++i]);
+	}
+
+	string stExtension;
+	bool stBinary = false;
+	TreeEmitter* emitter = GetEmitter(format, showPosition, stExtension, stBinary);
+	if(!emitter)
+	{
+		cout << "Unknown format: " << format.c_str() << endl;
+		return 0;
+	}
 
 	//char* fileName = "../test.ebnf";
 	//bool showPosition = true;
@@ -48,20 +76,42 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
+	if(edits)
+	{
+		CheckEdits(fs, edits);
+		return 0;
+	}
+
 	//Get Parser for EBNF files and do parsing
 	Parser* ebnf_parser = EBNF_Parser();
 	STNode* ebnf_tree = 0;
-	Result r = ebnf_parser->Parse(fs, ebnf_tree);
-	if(!r)
+	if(recover)
 	{
-		ParserFailure(r, fs);
-		return 0;
+		vector<Error> errors;
+		ebnf_parser->Parse(fs, ebnf_tree, errors);
+		if(!errors.empty())
+		{
+			for(unsigned int i = 0; i < errors.size(); i++)
+				ParserFailure(errors[i], fs);
+			delete ebnf_tree;
+			return 0;
+		}
+	}
+	else
+	{
+		Error e;
+		Result r = ebnf_parser->Parse(fs, ebnf_tree, e);
+		if(!r)
+		{
+			ParserFailure(e, fs);
+			return 0;
+		}
 	}
 
 	//Get Semantics and check
 	Semantics* ebnf_semantics = EBNF_Semantics();
-	Result s = ebnf_semantics->Check(ebnf_tree);
-	if(!s)
+	Error s = ebnf_semantics->Check(ebnf_tree);
+	if(s)
 	{
 		SemanticsFailure(s);
 		delete ebnf_tree;
@@ -69,13 +119,17 @@ int main(int argc, char* argv[])
 	}
 
 	//Generate test file with obtained AST tree
-	string stFileName = GetPath(fileName) + GetName(fileName) + ".st";
-	PreWalk(ebnf_tree, new PrintVisitor(ofstream(stFileName), showPosition));
-	cout << "ST  generated => " << stFileName.c_str() << endl;
+	string stFileName = GetPath(fileName) + GetName(fileName) + stExtension;
+	if(!EmitTree(ebnf_tree, emitter, stFileName, stBinary))
+	{
+		cout << "Unable to write: " << stFileName.c_str() << endl;
+		delete ebnf_tree;
+		return 0;
+	}
 
 	CodeGenerator* ebnf_code_generator = EBNF_CodeGenerator();
-	Result t = ebnf_code_generator->Generate(ebnf_tree, GetPath(fileName));
-	if(!t)
+	Error t = ebnf_code_generator->Generate(ebnf_tree, GetPath(fileName));
+	if(t)
 	{
 		CodeGeneratorFailure(t);
 		delete ebnf_tree;
@@ -87,23 +141,57 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
-PrintVisitor::PrintVisitor(ostream& _stream, bool _showPosition)
-	: out(_stream), showPosition(_showPosition)
+TreeEmitter* GetEmitter(const string& _format, bool _showPosition, string& _extension, bool& _binary)
 {
-}
+	_binary = false;
 
-bool PrintVisitor::Visit(STNode* _node, unsigned int _level)
-{
-	for(unsigned int i = 0; i < _level; i++)
-		out << "\t";
-
-	out << _node->data.c_str();
-
-	if(showPosition)
-		out << "(" << _node->where.row << ", " << _node->where.column << ")";
+	if(_format == "text")
+	{
+		_extension = ".st";
+		return TextEmitter(_showPosition);
+	}
+	if(_format == "json")
+	{
+		_extension = ".json";
+		return JsonEmitter(_showPosition);
+	}
+	if(_format == "sexp")
+	{
+		_extension = ".sexp";
+		return SExpressionEmitter(_showPosition);
+	}
+	if(_format == "bin")
+	{
+		_extension = ".stb";
+		_binary = true;
+		return BinaryEmitter();
+	}
 
-	out << endl;
+	return 0;
+}
 
+bool EmitTree(STNode* _tree, TreeEmitter* _emitter, const string& _fileName, bool _binary)
+{
+	FILE* file = 0;
+	fopen_s(&file, _fileName.c_str(), _binary ? "wb" : "w");
+	if(!file)
+		return false;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool written = _emitter->Emit(_tree, file);
+	written = (fclose(file) == 0) && written;
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	if(!written)
+		return false;
+
+	//Report output throughput
+	double megabytes = _emitter->Bytes() / (1024.0 * 1024.0);
+	cout << "ST  generated => " << _fileName.c_str();
+	cout << " (" << _emitter->Bytes() << " bytes in " << seconds * 1000.0 << " ms";
+	if(seconds > 0)
+		cout << ", " << megabytes / seconds << " MB/s";
+	cout << ")" << endl;
 	return true;
 }
 
@@ -141,43 +229,122 @@ string Translate(char _c)
 	return string(1, _c);
 }
 
-void ParserFailure(const Result& _r, Stream* _s)
+void ParserFailure(const Error& _e, Stream* _s)
 {
 	cout << "Failure" << endl;
 
 	//Put stream pointing to where the error is located 
-	_s->Goto(_r.fail.where);
+	_s->Goto(_e.where);
 
-	cout << "At (" << _r.fail.where.row << ", " << _r.fail.where.column << ") ";
+	cout << "At (" << _e.where.row << ", " << _e.where.column << ") ";
 		
 	//We found this character...
 	cout << "Found: [" << Translate(_s->Get()) << "]" << endl; 
 		
 	//But we were expecting one of those...
-	for(unsigned int i = 0; i < _r.fail.expected.size(); i++)
+	for(unsigned int i = 0; i < _e.expected.size(); i++)
 	{
-		cout << "\tExpected: [" << _r.fail.expected[i] << "]" << endl; 
+		cout << "\tExpected: [" << _e.expected[i] << "]" << endl; 
 	}
 }
 
-void SemanticsFailure(const Result& _r)
+void SemanticsFailure(const Error& _e)
 {
 	cout << "Failure" << endl;
 
-	cout << "At (" << _r.fail.where.row << ", " << _r.fail.where.column << ")" << endl;
+	cout << "At (" << _e.where.row << ", " << _e.where.column << ")" << endl;
 		
-	for(unsigned int i = 0; i < _r.fail.expected.size(); i++)
+	for(unsigned int i = 0; i < _e.expected.size(); i++)
 	{
-		cout << "\tError: [" << _r.fail.expected[i] << "]" << endl; 
+		cout << "\tError: [" << _e.expected[i] << "]" << endl; 
 	}
 }
 
-void CodeGeneratorFailure(const Result& _r)
+void CodeGeneratorFailure(const Error& _e)
 {
 	cout << "Failure" << endl;
 
-	for(unsigned int i = 0; i < _r.fail.expected.size(); i++)
+	for(unsigned int i = 0; i < _e.expected.size(); i++)
+	{
+		cout << "\tError: [" << _e.expected[i] << "]" << endl; 
+	}
+}
+
+bool SameTree(STNode* _a, STNode* _b)
+{
+	if(!_a || !_b)
+		return _a == _b;
+
+	if(_a->data != _b->data || _a->where != _b->where || _a->Sons() != _b->Sons())
+		return false;
+
+	for(unsigned int i = 0; i < _a->Sons(); i++)
 	{
-		cout << "\tError: [" << _r.fail.expected[i] << "]" << endl; 
+		if(!SameTree(_a->Son(i), _b->Son(i)))
+			return false;
 	}
+
+	return true;
+}
+
+void CheckEdits(Stream* _s, unsigned int _edits)
+{
+	string text;
+	for(; !_s->AtEnd(); _s->Next())
+		text += _s->Get();
+
+	Parser* ebnf_parser = EBNF_Parser();
+	IncrementalParser* incremental = IncrementalParse(ebnf_parser, text);
+
+	//Edits are the same on every run, so that a mismatch can be reproduced
+	mt19937 random(1);
+	const char* snippets[] = {" ", "\n", "x", ";", "A = B;\n", "'", "\"", "(", ")", "# c\n", "Foo", "|", ""};
+	unsigned int kinds = sizeof(snippets) / sizeof(snippets[0]);
+
+	unsigned int mismatches = 0;
+	double incrementalSeconds = 0;
+	double scratchSeconds = 0;
+	for(unsigned int i = 0; i <= _edits; i++)
+	{
+		//The first parse is of the file as it is
+		if(i)
+		{
+			size_t offset = random() % (text.size() + 1);
+			size_t removed = min<size_t>(random() % 4, text.size() - offset);
+			string inserted = snippets[random() % kinds];
+
+			incremental->Edit(offset, removed, inserted);
+			text.replace(offset, removed, inserted);
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		STNode* incrementalTree = 0;
+		Error incrementalError;
+		Result incrementalResult = incremental->Parse(incrementalTree, incrementalError);
+		incrementalSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		start = chrono::steady_clock::now();
+		Stream* scratch = MemoryStream(text.data(), text.data() + text.size());
+		STNode* scratchTree = 0;
+		Error scratchError;
+		Result scratchResult = ebnf_parser->Parse(scratch, scratchTree, scratchError);
+		scratchSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		bool same = (!incrementalResult == !scratchResult) && (incremental->Text() == text) && SameTree(incrementalTree, scratchTree);
+		if(!scratchResult)
+			same = same && incrementalError.where == scratchError.where && incrementalError.expected == scratchError.expected;
+		if(!same)
+		{
+			mismatches++;
+			cout << "Mismatch after edit " << i << endl;
+		}
+
+		delete incrementalTree;
+		delete scratchTree;
+		delete scratch;
+	}
+
+	cout << "Edits: " << _edits << ", mismatches: " << mismatches << endl;
+	cout << "Incremental parses: " << incrementalSeconds * 1000.0 << " ms, parses from scratch: " << scratchSeconds * 1000.0 << " ms" << endl;
+	delete incremental;
 }
@@ -0,0 +1,55 @@
+/**
+* Differential check of the errors reported with memorization: a parser tried first under Clear, whose failures are dropped,
+* and then again at the same position, remembered, must report what it expects as when it is not tried under Clear.
+* Build: with src/Languages.cpp, as in "g++ -std=c++14 -pthread -Isrc test/MemoErrors.cpp src/Languages.cpp". Returns 0 if it holds.
+*/
+#include <iostream>
+#include <cstring>
+#include "Languages.h"
+
+static Error Diagnose(Parser* _p, const char* _input)
+{
+	Stream* s = MemoryStream(_input, _input + strlen(_input));
+	STNode* tree = 0;
+	Error error;
+	if(_p->Parse(s, tree, error))
+		error = Error();
+
+	delete tree;
+	delete s;
+	return error;
+}
+
+static void Print(const char* _name, const Error& _e)
+{
+	cout << _name << " at (" << _e.where.row << ", " << _e.where.column << ")";
+	for(unsigned int i = 0; i < _e.expected.size(); i++)
+		cout << " [" << _e.expected[i] << "]";
+	cout << endl;
+}
+
+int main()
+{
+	//start = "a"* b? ("b" | "?"), with the optional b under Clear, and the same without it
+	Parser* b = Word("b");
+	Parser* cleared = Sequence(3, Star(Word("a")), Optional(Clear(Reference(&b))), Choice(2, Reference(&b), Word("?")));
+	Parser* plain = Sequence(2, Star(Word("a")), Choice(2, Word("b"), Word("?")));
+
+	const char* inputs[] = {"ax", "x", "aaa!", "a?b"};
+	int failures = 0;
+	for(unsigned int i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+	{
+		Error expected = Diagnose(plain, inputs[i]);
+		Error found = Diagnose(cleared, inputs[i]);
+		if(found.where != expected.where || found.expected != expected.expected)
+		{
+			cout << "Mismatch on \"" << inputs[i] << "\"" << endl;
+			Print("\tExpected", expected);
+			Print("\tFound   ", found);
+			failures++;
+		}
+	}
+
+	cout << (failures ? "Failure" : "Success!") << endl;
+	return failures ? 1 : 0;
+}